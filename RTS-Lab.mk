@@ -64,7 +64,7 @@ AS       := /Applications/GCCToolchains/gcc-arm/bin/arm-none-eabi-as
 CodeLiteDir:=/Applications/codelite.app/Contents/SharedSupport/
 TOOLDIR:=/Applications/GccToolchains
 Objects0=$(IntermediateDirectory)/driver_src_stm32f4xx_syscfg.c$(ObjectSuffix) $(IntermediateDirectory)/driver_src_stm32f4xx_exti.c$(ObjectSuffix) $(IntermediateDirectory)/driver_src_stm32f4xx_can.c$(ObjectSuffix) $(IntermediateDirectory)/driver_src_stm32f4xx_rcc.c$(ObjectSuffix) $(IntermediateDirectory)/startup.c$(ObjectSuffix) $(IntermediateDirectory)/sciTinyTimber.c$(ObjectSuffix) $(IntermediateDirectory)/application.c$(ObjectSuffix) $(IntermediateDirectory)/driver_src_stm32f4xx_dac.c$(ObjectSuffix) $(IntermediateDirectory)/melody.c$(ObjectSuffix) $(IntermediateDirectory)/driver_src_stm32f4xx_usart.c$(ObjectSuffix) \
-	$(IntermediateDirectory)/TinyTimber.c$(ObjectSuffix) $(IntermediateDirectory)/driver_src_stm32f4xx_gpio.c$(ObjectSuffix) $(IntermediateDirectory)/musicPlayer.c$(ObjectSuffix) $(IntermediateDirectory)/sioTinyTimber.c$(ObjectSuffix) $(IntermediateDirectory)/toneGenerator.c$(ObjectSuffix) $(IntermediateDirectory)/dispatch.s$(ObjectSuffix) $(IntermediateDirectory)/canHandler.c$(ObjectSuffix) $(IntermediateDirectory)/driver_src_stm32f4xx_tim.c$(ObjectSuffix) $(IntermediateDirectory)/buttonHandler.c$(ObjectSuffix) $(IntermediateDirectory)/canTinyTimber.c$(ObjectSuffix) \
+	$(IntermediateDirectory)/TinyTimber.c$(ObjectSuffix) $(IntermediateDirectory)/driver_src_stm32f4xx_gpio.c$(ObjectSuffix) $(IntermediateDirectory)/musicPlayer.c$(ObjectSuffix) $(IntermediateDirectory)/sioTinyTimber.c$(ObjectSuffix) $(IntermediateDirectory)/toneGenerator.c$(ObjectSuffix) $(IntermediateDirectory)/audioEngine.c$(ObjectSuffix) $(IntermediateDirectory)/dacSink.c$(ObjectSuffix) $(IntermediateDirectory)/dispatch.s$(ObjectSuffix) $(IntermediateDirectory)/canHandler.c$(ObjectSuffix) $(IntermediateDirectory)/driver_src_stm32f4xx_tim.c$(ObjectSuffix) $(IntermediateDirectory)/buttonHandler.c$(ObjectSuffix) $(IntermediateDirectory)/canTinyTimber.c$(ObjectSuffix) \
 	$(IntermediateDirectory)/ledHandler.c$(ObjectSuffix) 
 
 
@@ -191,6 +191,18 @@ $(IntermediateDirectory)/toneGenerator.c$(ObjectSuffix): toneGenerator.c
 $(IntermediateDirectory)/toneGenerator.c$(PreprocessSuffix): toneGenerator.c
 	$(CC) $(CFLAGS) $(IncludePath) $(PreprocessOnlySwitch) $(OutputSwitch) $(IntermediateDirectory)/toneGenerator.c$(PreprocessSuffix) toneGenerator.c
 
+$(IntermediateDirectory)/audioEngine.c$(ObjectSuffix): audioEngine.c
+	@$(CC) $(CFLAGS) $(IncludePath) -MG -MP -MT$(IntermediateDirectory)/audioEngine.c$(ObjectSuffix) -MF$(IntermediateDirectory)/audioEngine.c$(DependSuffix) -MM audioEngine.c
+	$(CC) $(SourceSwitch) "/Users/qalle/Github/Jobb/music-player/audioEngine.c" $(CFLAGS) $(ObjectSwitch)$(IntermediateDirectory)/audioEngine.c$(ObjectSuffix) $(IncludePath)
+$(IntermediateDirectory)/audioEngine.c$(PreprocessSuffix): audioEngine.c
+	$(CC) $(CFLAGS) $(IncludePath) $(PreprocessOnlySwitch) $(OutputSwitch) $(IntermediateDirectory)/audioEngine.c$(PreprocessSuffix) audioEngine.c
+
+$(IntermediateDirectory)/dacSink.c$(ObjectSuffix): dacSink.c
+	@$(CC) $(CFLAGS) $(IncludePath) -MG -MP -MT$(IntermediateDirectory)/dacSink.c$(ObjectSuffix) -MF$(IntermediateDirectory)/dacSink.c$(DependSuffix) -MM dacSink.c
+	$(CC) $(SourceSwitch) "/Users/qalle/Github/Jobb/music-player/dacSink.c" $(CFLAGS) $(ObjectSwitch)$(IntermediateDirectory)/dacSink.c$(ObjectSuffix) $(IncludePath)
+$(IntermediateDirectory)/dacSink.c$(PreprocessSuffix): dacSink.c
+	$(CC) $(CFLAGS) $(IncludePath) $(PreprocessOnlySwitch) $(OutputSwitch) $(IntermediateDirectory)/dacSink.c$(PreprocessSuffix) dacSink.c
+
 $(IntermediateDirectory)/dispatch.s$(ObjectSuffix): dispatch.s
 	@$(CXX) $(CXXFLAGS) $(IncludePCH) $(IncludePath) -MG -MP -MT$(IntermediateDirectory)/dispatch.s$(ObjectSuffix) -MF$(IntermediateDirectory)/dispatch.s$(DependSuffix) -MM dispatch.s
 	$(AS) "/Users/qalle/Github/Jobb/music-player/dispatch.s" $(ASFLAGS) $(ObjectSwitch)$(IntermediateDirectory)/dispatch.s$(ObjectSuffix) -I$(IncludePath)
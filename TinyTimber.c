@@ -38,11 +38,22 @@
  */
 
 #include "TinyTimber.h"
+#ifdef __TINYTIMBER_POSIX
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#undef __USE_LOCAL_SBRK // the host C library manages its own heap
+#undef __USE_SAFE_TIMER // stops TIM5, which the host does not have
+#else
 #include "stm32f4xx.h"
 #include "stm32f4xx_gpio.h"
 #include "stm32f4xx_rcc.h"
 #include "stm32f4xx_tim.h"
 #include "stm32f4xx_usart.h"
+#endif
 
 
 void DUMPC(char);
@@ -87,6 +98,134 @@ void DUMPD(int val) {
     DUMPC(buf[--i]);
 }
 
+#ifdef __TINYTIMBER_POSIX
+// POSIX dependencies
+//
+// Interrupts are signals: SIGALRM for the kernel timer and a real-time
+// signal for each installed vector. Masking them all stands in for BASEPRI,
+// and the threads are ucontexts switched by swapcontext(), which also saves
+// and restores each thread's signal mask.
+
+static void posixSignals(sigset_t *set) {
+  int sig;
+  sigemptyset(set);
+  sigaddset(set, SIGALRM);
+  for (sig = SIGRTMIN; sig <= SIGRTMAX; sig++)
+    sigaddset(set, sig);
+}
+
+static int posixEnabled(void) {
+  sigset_t now;
+  sigprocmask(SIG_BLOCK, NULL, &now);
+  return !sigismember(&now, SIGALRM);
+}
+
+static void posixMask(int how) {
+  sigset_t set;
+  posixSignals(&set);
+  sigprocmask(how, &set, NULL);
+}
+
+int posixHandler = 0; // nonzero while the current thread runs a handler
+
+#define THREADMODE() (!posixHandler)
+
+// The exclusive monitor of LDREX/STREX, for the fast path of SYNC. Every
+// signal handler clears it, as an exception does, so a store after a test
+// that it came between fails and the test is redone. The store itself is
+// committed by a compare and swap of the monitor, and a handler that comes
+// between that and the store makes the store first.
+enum { MONITOR_OPEN, MONITOR_EXCLUSIVE, MONITOR_STORING };
+
+int posixMonitor = MONITOR_OPEN;
+struct {
+  struct thread_block **to, *from, *value;
+} posixStore; // the store committed while MONITOR_STORING
+
+static void posixStoreIf(struct thread_block **to, struct thread_block *from,
+                         struct thread_block *value) {
+  __atomic_compare_exchange_n(to, &from, value, 0, __ATOMIC_SEQ_CST,
+                              __ATOMIC_SEQ_CST);
+}
+
+/* at the entry of every handler, with the signals blocked */
+static void posixClearExclusive(void) {
+  if (posixMonitor == MONITOR_STORING)
+    posixStoreIf(posixStore.to, posixStore.from, posixStore.value);
+  posixMonitor = MONITOR_OPEN;
+}
+
+static inline struct thread_block *
+posixLoadExclusive(struct thread_block **from) {
+  __atomic_store_n(&posixMonitor, MONITOR_EXCLUSIVE, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(from, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Store value to *to, which must still hold from, unless a handler has run
+ * since posixLoadExclusive(). A store that a handler made is not made
+ * again: only the caller can put from back.
+ */
+static inline int posixStoreExclusive(struct thread_block **to,
+                                      struct thread_block *from,
+                                      struct thread_block *value) {
+  int armed = MONITOR_EXCLUSIVE;
+
+  posixStore.to = to;
+  posixStore.from = from;
+  posixStore.value = value;
+  if (!__atomic_compare_exchange_n(&posixMonitor, &armed, MONITOR_STORING, 0,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    return 0;
+  posixStoreIf(to, from, value);
+  __atomic_store_n(&posixMonitor, MONITOR_OPEN, __ATOMIC_SEQ_CST);
+  return 1;
+}
+
+#define ENABLED() posixEnabled()
+#define DISABLE()                                                              \
+  { posixMask(SIG_BLOCK); }
+#define ENABLE(s)                                                              \
+  {                                                                            \
+    if (s)                                                                     \
+      posixMask(SIG_UNBLOCK);                                                  \
+  }
+#ifdef __TINYTIMBER_SIM
+static void simIdle(void);
+
+#define SLEEP()                                                                \
+  { simIdle(); }
+#else
+#define SLEEP()                                                                \
+  {                                                                            \
+    sigset_t none;                                                             \
+    sigemptyset(&none);                                                        \
+    sigsuspend(&none);                                                         \
+  }
+#endif
+
+#define RED_ALERT()                                                            \
+  { DUMP("RED ALERT!\n"); }
+
+#ifdef __USE_IRQ_STATS
+static uint32_t posixCycles(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint32_t)(t.tv_sec * 1000000000LL + t.tv_nsec);
+}
+
+#define CYCLES() posixCycles() // nanoseconds on the host
+#define CYCLES_NS(c) (c)
+#endif
+
+#define PANIC(s)                                                               \
+  {                                                                            \
+    DUMP("PANIC!!! ");                                                         \
+    DUMP(s);                                                                   \
+    DUMP("\n");                                                                \
+    exit(1);                                                                   \
+  }
+#else
 // Cortex m4 dependencies
 
 #define __CURRENT_PRIORITY ((__get_BASEPRI() >> (8 - __NVIC_PRIO_BITS)))
@@ -100,6 +239,9 @@ void cli(void) { __set_BASEPRI(__ENABLED_PRIORITY << (8 - __NVIC_PRIO_BITS)); }
 
 #define THREADMODE() (__CURRENT_EXCEPTION == 0)
 
+#define CYCLES() (DWT->CYCCNT)
+#define CYCLES_NS(c) ((uint32_t)((c)*1000ULL / (SystemCoreClock / 1000000)))
+
 #define ENABLED() (!PROTECTED())
 #define DISABLE()                                                              \
   { sei(); }
@@ -108,8 +250,16 @@ void cli(void) { __set_BASEPRI(__ENABLED_PRIORITY << (8 - __NVIC_PRIO_BITS)); }
     if (s)                                                                     \
       cli();                                                                   \
   }
+// Entered with interrupts disabled. BASEPRI would keep them from waking the
+// core, so PRIMASK holds them off across the wfi instead; the one that woke
+// it is taken once PRIMASK is cleared.
 #define SLEEP()                                                                \
-  { __asm volatile("     wfi\n"); }
+  {                                                                            \
+    __disable_irq();                                                           \
+    cli();                                                                     \
+    __asm volatile("     wfi\n");                                              \
+    __enable_irq();                                                            \
+  }
 
 #define RED_ALERT()                                                            \
   { GPIO_WriteBit(GPIOB, GPIO_Pin_1, (BitAction)0); } // Red LED On
@@ -120,8 +270,9 @@ void cli(void) { __set_BASEPRI(__ENABLED_PRIORITY << (8 - __NVIC_PRIO_BITS)); }
     RED_ALERT();                                                               \
     DUMP(s);                                                                   \
     while (1)                                                                  \
-      SLEEP();                                                                 \
+      __asm volatile("     wfi\n"); /* with interrupts as they were */         \
   }
+#endif
 
 #ifdef __USE_LOCAL_SBRK
 // register char *__stack_ptr asm ("sp");
@@ -148,37 +299,243 @@ void *_sbrk(int incr) {
 }
 #endif
 
-#define NMSGS 30
-#define NTHREADS 4
+#define COUNT_THREAD(bytes) +1
+#define NTHREADS (0 __THREAD_STACKS(COUNT_THREAD))
 
-#define CONTEXTSIZE (2 + 16 + 8 + 16 + 10)
+#define STACK_T long long
 
-#define CONTEXT_T uint32_t
+#define STACK_WORDS(bytes) +((bytes) / sizeof(STACK_T))
+#define STACK_BYTES(bytes) ((bytes) / sizeof(STACK_T) * sizeof(STACK_T)),
 
-#define STACKSIZE 1024
+#define STACK_PAINT 0xA5A5A5A5A5A5A5A5LL // marks stack words never written
 
-#define STACK_T long long
+#ifdef __TINYTIMBER_POSIX
+#define CONTEXT_T ucontext_t
+
+// Threads are created with the kernel signals blocked, as run() expects.
+#define SETCONTEXT(c) getcontext(&(c))
+
+void SETSTACK(CONTEXT_T *cp, STACK_T *sp, int size) {
+  cp->uc_stack.ss_sp = sp;
+  cp->uc_stack.ss_size = size;
+  cp->uc_link = NULL;
+  posixSignals(&cp->uc_sigmask);
+}
+
+void SETPC(CONTEXT_T *cp, void (*fp)(void)) { makecontext(cp, fp, 0); }
+
+#define TIMER_COMPARE_INTERRUPT void vect_TIM5(void)
+
+TIMER_COMPARE_INTERRUPT;
+
+static void posixTimerSignal(int sig) {
+  int wasHandler = posixHandler;
+  posixClearExclusive();
+  posixHandler = 1;
+  vect_TIM5();
+  posixHandler = wasHandler;
+}
+
+#ifdef __TINYTIMBER_SIM
+// Simulated time
+//
+// The clock only moves when a method is charged its SIM_COST or when the
+// system is idle, when it jumps straight to the next timer compare or
+// scripted input. Events are raised as signals while interrupts are enabled,
+// so they are delivered at once and every run is the same.
+
+LongTime simNow = 0;
+Time simCompare; // timer compare value, valid while simArmed
+int simArmed = 0;
+
+struct {
+  Method method;
+  Time cost;
+} simCosts[__SIM_COST_SLOTS];
+Time simDefaultCost = 0;
+
+void TIMER_INIT() {
+  struct sigaction sa;
+
+  sa.sa_handler = posixTimerSignal;
+  sa.sa_flags = SA_RESTART;
+  posixSignals(&sa.sa_mask); // handlers run with interrupts disabled
+  sigaction(SIGALRM, &sa, NULL);
+}
+
+#define TIMER_CCLR()
+
+#define TIMER_EPOCH()
+
+#define TIMERGET(x) (x = (Time)simNow)
+
+#define LONGTIMERGET(x) (x = simNow)
+
+#define TIMERSET(t) (simCompare = (t), simArmed = 1)
+
+LongTime sim_time(void) { return simNow; }
+
+void sim_start(LongTime t) { simNow = t; }
+
+void SIM_COST(Method meth, Time cost) {
+  int i;
+
+  if (!meth) {
+    simDefaultCost = cost;
+    return;
+  }
+  for (i = 0; i < __SIM_COST_SLOTS; i++) {
+    if (!simCosts[i].method || simCosts[i].method == meth) {
+      simCosts[i].method = meth;
+      simCosts[i].cost = cost;
+      return;
+    }
+  }
+  PANIC("SIM_COST: out of slots");
+}
+
+static Time simCost(Method meth) {
+  int i;
+
+  for (i = 0; i < __SIM_COST_SLOTS && simCosts[i].method; i++)
+    if (simCosts[i].method == meth)
+      return simCosts[i].cost;
+  return simDefaultCost;
+}
+
+/* find the next event; *timer tells if it is the timer compare */
+static int simNext(Time *at, int *timer) {
+  Time input;
+  int any = sim_next_input(&input);
+
+  *timer = simArmed && (!any || !TIME_BEFORE(input, simCompare));
+  *at = *timer ? simCompare : input;
+  return *timer || any;
+}
+
+/*
+ * Advance to time at and deliver the event there. From simIdle, which runs
+ * with interrupts disabled, the timer signal stays pending until idle()
+ * enables them again.
+ */
+static void simStep(Time at, int timer) {
+  if (TIME_BEFORE(simNow, at))
+    simNow += TIME_DIFF(at, simNow);
+  if (timer) {
+    simArmed = 0;
+    raise(SIGALRM);
+  } else
+    sim_input();
+}
+
+static void simIdle(void) {
+  Time at;
+  int timer;
+
+  if (!simNext(&at, &timer)) {
+    DUMP("Simulation ended: nothing more will happen\n");
+    exit(0);
+  }
+  simStep(at, timer);
+}
+
+/* let cost ticks pass for the current thread, taking events due meanwhile */
+static void simCharge(Time cost) {
+  Time at;
+  int timer;
+
+  while (cost > 0) {
+    if (simNext(&at, &timer) && TIME_DIFF(at, simNow) < cost) {
+      if (TIME_BEFORE(simNow, at))
+        cost -= TIME_DIFF(at, simNow);
+      simStep(at, timer); // may switch to a more urgent thread for a while
+    } else {
+      simNow += cost;
+      cost = 0;
+    }
+  }
+}
+#else
+struct timespec posixEpoch; // time 0
+timer_t posixTimer;
+
+void TIMER_INIT() {
+  struct sigaction sa;
+  struct sigevent se = {0};
+
+  clock_gettime(CLOCK_MONOTONIC, &posixEpoch);
+
+  sa.sa_handler = posixTimerSignal;
+  sa.sa_flags = SA_RESTART;
+  posixSignals(&sa.sa_mask); // handlers run with interrupts disabled
+  sigaction(SIGALRM, &sa, NULL);
+
+  se.sigev_notify = SIGEV_SIGNAL;
+  se.sigev_signo = SIGALRM;
+  if (timer_create(CLOCK_MONOTONIC, &se, &posixTimer))
+    PANIC("timer_create failed");
+}
+
+#define TIMER_CCLR()
+
+#define TIMER_EPOCH()
+
+static LongTime posixNow(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec - posixEpoch.tv_sec) * 100000LL +
+         (t.tv_nsec - posixEpoch.tv_nsec) / 10000;
+}
+
+/* arm the timer for kernel time t, which may already have passed */
+static void posixTimerSet(Time t) {
+  LongTime now = posixNow();
+  long long ns = posixEpoch.tv_nsec + (now + TIME_DIFF(t, now)) * 10000;
+  struct itimerspec when = {{0, 0}, {0, 0}};
+
+  when.it_value.tv_sec = posixEpoch.tv_sec + ns / 1000000000;
+  when.it_value.tv_nsec = ns % 1000000000;
+  if (when.it_value.tv_nsec < 0) {
+    when.it_value.tv_sec--;
+    when.it_value.tv_nsec += 1000000000;
+  }
+  timer_settime(posixTimer, TIMER_ABSTIME, &when, NULL);
+}
 
-struct stack;
+#define TIMERGET(x) (x = (Time)posixNow())
+
+#define LONGTIMERGET(x) (x = posixNow())
+
+#define TIMERSET(t) posixTimerSet(t)
+#endif
+
+void DUMPC(char c) { write(1, &c, 1); } // stdout stands in for USART1
+#else
+#define CONTEXTSIZE (8 + 10)
+
+#define CONTEXT_T uint32_t
 
 /*
- * Context:
+ * Initial context of a thread, which has not used the FPU yet:
  *
- * FPSCR + fill	(2 words)	(OFFSET = 50-51)
- * S15-S0		(16 words)	(OFFSET = 34-49)
- * xPSR,					(OFFSET = 33)
- * PC,						(OFFSET = 32)
- * LR, 						(OFFSET = 31)
- * R12,						(OFFSET = 30)
- * R3-R0		(8 words)	(OFFSET = 26-29)
- * S31-S16		(16 words)	(OFFSET = 10-25)
+ * xPSR,					(OFFSET = 17)
+ * PC,						(OFFSET = 16)
+ * LR, 						(OFFSET = 15)
+ * R12,						(OFFSET = 14)
+ * R3-R0		(4 words)	(OFFSET = 10-13)
  * R11-R4,					(OFFSET = 2-9)
  * BASEPRI,					(OFFSET = 1)
  * EXC_RETURN	(10 words)	(OFFSET = 0)
+ *
+ * Once a thread executes an FP instruction its saved context also holds
+ * S31-S16 between R11-R4 and the exception frame, which is then extended
+ * with S15-S0 and FPSCR. dispatch.s tests bit 4 of the saved EXC_RETURN to
+ * tell the two apart, and lazy stacking (FPU->FPCCR in startup.c) defers
+ * saving S15-S0 until a handler actually touches the FPU.
  */
 
-#define CONTEXT_xPSR_OFF 33
-#define CONTEXT_PC_OFF 32
+#define CONTEXT_xPSR_OFF 17
+#define CONTEXT_PC_OFF 16
 #define CONTEXT_BASEPRI_OFF 1
 #define CONTEXT_EXC_OFF 0
 
@@ -186,15 +543,14 @@ struct stack;
 
 #define SETCONTEXT(c)
 
-void SETSTACK(CONTEXT_T *cp, struct stack *sp) {
-  *cp = ((CONTEXT_T)sp) + STACKSIZE * sizeof(STACK_T) -
-        CONTEXTSIZE * sizeof(CONTEXT_T);
+void SETSTACK(CONTEXT_T *cp, STACK_T *sp, int size) {
+  *cp = ((CONTEXT_T)sp) + size - CONTEXTSIZE * sizeof(CONTEXT_T);
 
   CONTEXT_T ci = *cp;
   int i;
   for (i = 0; i < CONTEXTSIZE; i++)
     HW32_REG(ci + (i << 2)) = 0;
-  HW32_REG(ci + (CONTEXT_EXC_OFF << 2)) = 0xFFFFFFE9;
+  HW32_REG(ci + (CONTEXT_EXC_OFF << 2)) = 0xFFFFFFF9; // thread, MSP, no FP
   HW32_REG(ci + (CONTEXT_BASEPRI_OFF << 2)) = __ENABLED_PRIORITY;
   HW32_REG(ci + (CONTEXT_xPSR_OFF << 2)) = 0x01000000;
 }
@@ -214,7 +570,8 @@ PendSV_Exception;
 
 SVCall_Exception;
 
-#define TIM5_IRQ_VECTOR (0x2001C000 + 0x108)
+#define IRQ_VECTOR(i) (0x2001C000 + 0x40 + 4 * (i)) // of enum Vector i
+#define TIM5_IRQ_VECTOR IRQ_VECTOR(IRQ_TIM5)
 #define TIMER_COMPARE_INTERRUPT void vect_TIM5(void)
 
 TIMER_COMPARE_INTERRUPT;
@@ -251,66 +608,243 @@ void TIMER_INIT() {
   NVIC_EnableIRQ(TIM5_IRQn);
 
   TIM_SetCounter(TIM5, 0);
+  TIM_ClearITPendingBit(TIM5, TIM_IT_Update); // set by TIM_TimeBaseInit
   TIM_Cmd(TIM5, ENABLE);
 
-  TIM_ITConfig(TIM5, TIM_IT_CC1, ENABLE);
+  TIM_ITConfig(TIM5, TIM_IT_CC1 | TIM_IT_Update, ENABLE);
+
+#if defined(__USE_IRQ_STATS) || defined(__USE_SWITCH_STATS)
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; // enable the DWT
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
 }
 
 #define TIMER_CCLR()                                                           \
   { TIM_ClearITPendingBit(TIM5, TIM_IT_CC1); } // Timer compare interrupt clear
 
+// Counter overflow, once every 2^32 ticks: count it in overflows.
+#define TIMER_EPOCH()                                                          \
+  {                                                                            \
+    if (TIM_GetITStatus(TIM5, TIM_IT_Update) == SET) {                         \
+      TIM_ClearITPendingBit(TIM5, TIM_IT_Update);                              \
+      overflows++;                                                             \
+    }                                                                          \
+  }
+
 #define TIMERGET(x) (x = TIM_GetCounter(TIM5))
 
-#define TIMERSET(x) (TIM_SetCompare1(TIM5, x->baseline))
+#define LONGTIMERGET(x) (x = timerLongNow())
 
-#define INFINITY 0x7fffffffL
+#define TIMERSET(t) (TIM_SetCompare1(TIM5, t))
 
 void DUMPC(char c) {
   USART_SendData(USART1, c);
   while (USART_GetFlagStatus(USART1, USART_FLAG_TXE) == RESET)
     ;
 }
+#endif
 
 // End of target dependencies
 
 typedef struct thread_block *Thread;
+typedef struct msg_block *Message;
 
 #define INSTALLED_TAG (Thread)1
 
+enum msg_state { MSG_FREE, MSG_TIMED, MSG_READY, MSG_ACTIVE };
+
+#define HANDLE_INDEX_BITS 12 // of a Msg handle, see HANDLE
+#if NMSGS >= (1 << HANDLE_INDEX_BITS)
+#error "NMSGS is too large for the index in a Msg handle"
+#endif
+
 struct msg_block {
-  Msg next;      // for use in linked lists
-  Time baseline; // event time reference point
-  Time deadline; // absolute deadline (=priority)
-  Object *to;    // receiving object
-  Method method; // code to run
-  int arg;       // argument to the above
+  Message next, prev;  // for use in linked lists
+  int heapIndex;       // position in timerQ or msgQ while pending there
+  unsigned order;      // insertion order, breaks ties between equal keys
+  unsigned generation : 32 - HANDLE_INDEX_BITS; // bumped on every recycle()
+  char state;          // enum msg_state: where the message currently is
+  char infinite;       // no deadline given, ranks after every finite deadline
+  Thread thread;       // thread executing the message (MSG_ACTIVE)
+  Time baseline;       // event time reference point
+  Time deadline;       // absolute deadline (=priority)
+  Time period;         // re-release interval, 0 if not periodic
+  Object *to;          // receiving object
+  Method method;       // code to run
+  int arg;             // argument to the above
+  int data[(__PAYLOAD_SIZE + sizeof(int) - 1) / sizeof(int)]; // arg points here
+};
+
+/*
+ * A Msg handed out to the application encodes the index of its msg_block
+ * (plus one, in the low HANDLE_INDEX_BITS bits) and the block's generation
+ * at the time of sending (in the 20 bits above), so a handle kept past the
+ * end of its message no longer matches once the block is reused. The
+ * generation wraps after 2^20 reuses, and a handle kept that long would
+ * denote whatever message then has the block. msgPool hands out blocks in
+ * FIFO order, so that takes at least 2^20 times as many sends as there are
+ * free blocks.
+ */
+#define HANDLE(m)                                                              \
+  ((Msg)(uintptr_t)(((uint32_t)(m)->generation << HANDLE_INDEX_BITS) |        \
+                    ((m) - messages + 1)))
+#define HANDLE_INDEX(h)                                                        \
+  ((int)((uintptr_t)(h) & ((1u << HANDLE_INDEX_BITS) - 1)) - 1)
+#define HANDLE_GENERATION(h) ((uint32_t)(uintptr_t)(h) >> HANDLE_INDEX_BITS)
+
+/*
+ * Binary min-heap of messages, ordered by the function before(). Each
+ * message records its own position (heapIndex) so that it can be located
+ * and removed without searching.
+ */
+struct msg_heap {
+  int size;
+  int (*before)(Message, Message);
+  Message item[NMSGS];
+};
+
+/*
+ * Ready queue. Messages with a finite deadline are kept in a heap in EDF
+ * order; messages without a deadline take an O(1) FIFO lane behind them.
+ */
+struct ready_queue {
+  struct msg_heap timed;
+  Message head, tail; // FIFO lane for infinite deadlines
 };
 
 struct thread_block {
   CONTEXT_T context; // machine state */
   int thread_no;
   Thread next;      // for use in linked lists
-  Msg msg;          // message under execution
+  Message msg;          // message under execution
   Object *waitsFor; // deadlock detection link
-};
-
-struct stack {
-  STACK_T stack[STACKSIZE];
+  STACK_T *stack;   // lowest word of the thread's stack
+  int stackSize;    // in bytes
 };
 
 struct msg_block messages[NMSGS];
 struct thread_block threads[NTHREADS];
-struct stack stacks[NTHREADS];
+STACK_T stacks[0 __THREAD_STACKS(STACK_WORDS)]; // all thread stacks, in order
+const int stackSizes[NTHREADS] = {__THREAD_STACKS(STACK_BYTES)};
 
 struct thread_block thread0;
 
-Msg msgPool = messages;
-Msg msgQ = NULL;
-Msg timerQ = NULL;
+static int byBaseline(Message, Message);
+static int byDeadline(Message, Message);
+
+Message msgPool = messages;
+Message msgPoolTail = &messages[NMSGS - 1];
+struct ready_queue msgQ = {{0, byDeadline}, NULL, NULL};
+struct msg_heap timerQ = {0, byBaseline};
+unsigned queueOrder = 0;
+int poolUsed = 0;
+int poolHighWater = 0;
+int poolDropped = 0;
+
+#ifdef __TRACE_BUFFER
+/*
+ * Kernel event trace. Records are only written with interrupts disabled or
+ * from an interrupt handler, which the kernel's critical sections exclude,
+ * so there is never more than one producer; idle() is the only consumer
+ * and streams the ring to USART1 without waiting on the transmitter. When
+ * the ring is full new records are counted in traceLost instead, and a
+ * TRACE_LOST record is written once there is room again.
+ *
+ * On the wire every record is framed as TRACE_FRAME_START, the record
+ * with multi-byte fields little-endian, and the XOR of the record bytes.
+ * host/traceDecoder.c reads this format.
+ */
+enum trace_event {
+  TRACE_DISPATCH = 1, // id: thread_no + 1 of the thread switched to
+  TRACE_RUN,          // id: method starting in the current thread
+  TRACE_DONE,         // id: method completed in the current thread
+  TRACE_ASYNC,        // id: method a message was sent to
+  TRACE_BLOCK,        // id: thread_no + 1 of the thread owning the object
+  TRACE_ABORT,        // id: method of the aborted message
+  TRACE_EXPIRE,       // id: method of the message released by the timer
+  TRACE_IRQ_ENTER,    // id: enum Vector, IRQ_TIM5 for the kernel timer
+  TRACE_IRQ_EXIT,     // id: as TRACE_IRQ_ENTER
+  TRACE_LOST          // id: number of records dropped
+};
+
+struct trace_record {
+  uint32_t time;  // TIM5 counter
+  uint8_t event;  // enum trace_event
+  uint8_t thread; // thread_no + 1 of the current thread, 0 for thread0
+  uint32_t id;
+};
+
+#define TRACE_FRAME_START 0x1E
+#define TRACE_FRAME_SIZE 12 // start byte, 10 record bytes, checksum
+
+#ifdef __TINYTIMBER_POSIX
+// On the host the trace goes to stderr, keeping stdout for the console.
+#define TRACE_PORT_IDLE() 1
+#define TRACE_PORT_READY() 1
+#define TRACE_PORT_SEND(b) write(2, &(b), 1)
+#else
+#define TRACE_PORT_IDLE() (!(USART1->CR1 & USART_CR1_TXEIE))
+#define TRACE_PORT_READY() (USART_GetFlagStatus(USART1, USART_FLAG_TXE) == SET)
+#define TRACE_PORT_SEND(b) USART_SendData(USART1, b)
+#endif
+
+#define METHOD_ID(m) ((uint32_t)(uintptr_t)(m)) // flash or RAM, Thumb bit set
+
+struct trace_record traceRing[__TRACE_BUFFER_SIZE];
+unsigned traceHead = 0; // written by producers only
+unsigned traceTail = 0; // written by idle() only
+unsigned traceLost = 0;
+
+#define TRACE(event, id) trace(event, id)
+#else
+#define TRACE(event, id)
+#endif
+
+#ifdef __USE_METHOD_STATS
+MethodStats methodStats[__METHOD_STATS_SLOTS];
+int methodStatsLost = 0; // completions of methods that found the table full
+#endif
+
+#ifdef __USE_TIMER_WHEEL
+#define WHEEL_MASK (__TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_WORDS (__TIMER_WHEEL_SLOTS / 32)
+
+/*
+ * Timing wheel for timed messages whose baseline lies less than
+ * __TIMER_WHEEL_SLOTS ticks after wheelTime; later ones spill to timerQ.
+ * Slot i holds, in FIFO order, the messages with baseline & WHEEL_MASK == i,
+ * and wheelBusy has a bit set for every non-empty slot.
+ */
+Message wheelHead[__TIMER_WHEEL_SLOTS];
+Message wheelTail[__TIMER_WHEEL_SLOTS];
+uint32_t wheelBusy[WHEEL_WORDS];
+int wheelCount = 0;
+Time wheelTime = 0;
+#endif
 int runAsHardware = 0;
 int doIRQSchedule = 0;
 Time timestamp = 0;
-int overflows = 0;
+int overflows = 0; // TIM5 counter wraps, see TIMER_EPOCH
+
+#ifdef __USE_IDLE_STATS
+IdleStats idleStats;
+Time idleStatsStart = 0;
+int idling = 0; // idle() is asleep since idleSince
+Time idleSince = 0;
+
+/* an interrupt at time now; ends the idle period if it woke the system */
+#define IDLE_END(now)                                                          \
+  {                                                                            \
+    if (idling) {                                                              \
+      idling = 0;                                                              \
+      idleStats.wakeups++;                                                     \
+      idleStats.idle += TIME_DIFF(now, idleSince);                             \
+    }                                                                          \
+  }
+#else
+#define IDLE_END(now)
+#endif
 
 Thread threadPool = threads;
 Thread activeStack = &thread0;
@@ -319,174 +853,599 @@ Thread upcoming;
 
 Method mtable[N_VECTORS];
 Object *otable[N_VECTORS];
+char ptable[N_VECTORS]; // NVIC priority of each installed vector
+#ifndef __TINYTIMBER_POSIX
+int started = 0; // the kernel is initialized, see install
+#endif
+
+#ifdef __USE_IRQ_STATS
+IrqStats irqStats[N_VECTORS]; // worst in CYCLES() units, see IRQ_STATS
+
+/* a run of the handler of vector n that began at cycle count start */
+static void irqStatsRecord(enum Vector n, uint32_t start) {
+  uint32_t cycles = CYCLES() - start;
+  irqStats[n].entries++;
+  if (cycles > irqStats[n].worst)
+    irqStats[n].worst = cycles;
+}
+
+#define IRQ_BEGIN(start) uint32_t start = CYCLES()
+#define IRQ_END(n, start) irqStatsRecord(n, start)
+#else
+#define IRQ_BEGIN(start)
+#define IRQ_END(n, start)
+#endif
+
+#ifdef __USE_SWITCH_STATS
+struct {
+  unsigned switches;
+  uint32_t worst;      // in CYCLES() units
+  uint64_t cycles;     // in total
+} switchStats;
+
+/*
+ * Called by dispatch.s, where it is weak, at the end of a context switch
+ * that began at cycle count start.
+ */
+void switchStatsRecord(uint32_t start) {
+  uint32_t cycles = CYCLES() - start;
+  switchStats.switches++;
+  switchStats.cycles += cycles;
+  if (cycles > switchStats.worst)
+    switchStats.worst = cycles;
+}
+#endif
 
 static void dispatch(Thread);
 static void schedule(void);
+static void rearm(Message);
+
+#ifndef __TINYTIMBER_POSIX
+/* the TIM5 counter extended by overflows; call with interrupts disabled */
+static LongTime timerLongNow(void) {
+  uint32_t low = TIM_GetCounter(TIM5);
+  LongTime high = overflows;
+  if (TIM_GetFlagStatus(TIM5, TIM_FLAG_Update) == SET && low < 0x80000000u)
+    high++; // wrapped, but TIMER_EPOCH has not run yet
+  return (high << 32) | low;
+}
+#endif
+#ifdef __TRACE_BUFFER
+static void trace(int, uint32_t);
+#endif
 
-// Cortex m4 dependencies
-
-#define USART1_IRQ_VECTOR (0x2001C000 + 0xD4)
-#define CAN1_IRQ_VECTOR (0x2001C000 + 0x90)
-#define EXTI9_5_IRQ_VECTOR (0x2001C000 + 0x9C)
-
-#ifdef __TRACE_SCHEDULE
-#define IRQ(n, v)                                                              \
-  void v(void) {                                                               \
-    DISABLE();                                                                 \
-    TIMERGET(timestamp);                                                       \
-    runAsHardware = 1;                                                         \
-    doIRQSchedule = 0;                                                         \
-    if (mtable[n])                                                             \
-      mtable[n](otable[n], n);                                                 \
-    DUMP("schedule() in IRQ()");                                               \
-    DUMP("\n\r");                                                              \
-    runAsHardware = 0;                                                         \
-    if (doIRQSchedule)                                                         \
-      schedule();                                                              \
-    doIRQSchedule = 0;                                                         \
-    ENABLE(1);                                                                 \
+/*
+ * Every installed vector enters here. A handler at the kernel's priority
+ * runs as hardware and may make the kernel reschedule on its way out; a
+ * fast handler may preempt the kernel, so it only runs.
+ */
+static void irq(enum Vector n) {
+  IRQ_BEGIN(start);
+  if (ptable[n] < __IRQ_PRIORITY) {
+    mtable[n](otable[n], n);
+    IRQ_END(n, start);
+    return;
   }
+  TIMERGET(timestamp);
+  IDLE_END(timestamp);
+  TRACE(TRACE_IRQ_ENTER, n);
+  runAsHardware = 1;
+  doIRQSchedule = 0;
+  mtable[n](otable[n], n);
+  runAsHardware = 0;
+  IRQ_END(n, start);
+  if (doIRQSchedule)
+    schedule();
+  doIRQSchedule = 0;
+  TRACE(TRACE_IRQ_EXIT, n);
+}
+
+#ifdef __TINYTIMBER_POSIX
+int posixSignalOf[N_VECTORS];  // real-time signal of each installed vector
+enum Vector posixVectorOf[64]; // vector of each signal from SIGRTMIN
+int posixSignalsUsed = 0;
+
+static void posixInterruptSignal(int sig) {
+  int wasHandler = posixHandler;
+  posixClearExclusive();
+  posixHandler = 1;
+  irq(posixVectorOf[sig - SIGRTMIN]);
+  posixHandler = wasHandler;
+}
+
+/* request interrupt i, as a host peripheral would raise its IRQ line */
+void posix_interrupt(enum Vector i) {
+  if (posixSignalOf[i]) // an IRQ without a handler is never enabled
+    kill(getpid(), posixSignalOf[i]);
+}
 #else
-#define IRQ(n, v)                                                              \
-  void v(void) {                                                               \
-    TIMERGET(timestamp);                                                       \
-    runAsHardware = 1;                                                         \
-    doIRQSchedule = 0;                                                         \
-    if (mtable[n])                                                             \
-      mtable[n](otable[n], n);                                                 \
-    runAsHardware = 0;                                                         \
-    if (doIRQSchedule)                                                         \
-      schedule();                                                              \
-    doIRQSchedule = 0;                                                         \
-  }
+/* the shared handler in the vector table, for every installed vector */
+void vect_IRQ(void) { irq((enum Vector)(__CURRENT_EXCEPTION - 16)); }
 #endif
 
-IRQ(IRQ_USART1, vect_USART1);
-IRQ(IRQ_CAN1, vect_CAN1);
-IRQ(IRQ_EXTI9_5, vect_EXTI9_5);
-
 // End of target dependencies
 
 /* queue manager */
-void enqueueByDeadline(Msg p, Msg *queue) {
-  Msg prev = NULL, q = *queue;
-  while (q && (q->deadline <= p->deadline)) {
-    prev = q;
-    q = q->next;
-  }
-  p->next = q;
-  if (prev == NULL)
-    *queue = p;
-  else
-    prev->next = p;
+/* strict EDF priority: a has an earlier deadline than b */
+static int earlier(Message a, Message b) {
+  if (!b)
+    return 1;
+  if (a->infinite || b->infinite) // FIFO among infinite, as in the lane
+    return !a->infinite ||
+           (b->infinite && (int)(a->order - b->order) < 0);
+  return TIME_BEFORE(a->deadline, b->deadline);
 }
 
-void enqueueByBaseline(Msg p, Msg *queue) {
-  Msg prev = NULL, q = *queue;
-  while (q && (q->baseline <= p->baseline)) {
-    prev = q;
-    q = q->next;
-  }
-  p->next = q;
-  if (prev == NULL)
-    *queue = p;
-  else
-    prev->next = p;
+static int byDeadline(Message a, Message b) {
+  if (a->deadline != b->deadline)
+    return TIME_BEFORE(a->deadline, b->deadline);
+  return (int)(a->order - b->order) < 0; // FIFO among equal deadlines
 }
 
-Msg dequeue(Msg *queue) {
-  Msg m = *queue;
-  if (m)
-    *queue = m->next;
-  else
-    PANIC("Empty queue"); // Empty queue, kernel panic!!!
-  return m;
+static int byBaseline(Message a, Message b) {
+  if (a->baseline != b->baseline)
+    return TIME_BEFORE(a->baseline, b->baseline);
+  return (int)(a->order - b->order) < 0; // FIFO among equal baselines
 }
 
-Msg dequeue_pool(Msg *queue) {
-  Msg m = *queue;
-  if (m)
-    *queue = m->next;
-  else
-    PANIC("Empty pool"); // Empty pool, kernel panic!!!
-  return m;
+#define HEAP_TOP(h) ((h)->item[0])
+
+static void heapPlace(struct msg_heap *h, Message m, int i) {
+  h->item[i] = m;
+  m->heapIndex = i;
 }
 
-void insert(Msg m, Msg *queue) {
-  m->next = *queue;
-  *queue = m;
+static void siftUp(struct msg_heap *h, int i) {
+  Message m = h->item[i];
+  while (i > 0) {
+    int parent = (i - 1) >> 1;
+    if (!h->before(m, h->item[parent]))
+      break;
+    heapPlace(h, h->item[parent], i);
+    i = parent;
+  }
+  heapPlace(h, m, i);
 }
 
-void push(Thread t, Thread *stack) {
-  t->next = *stack;
-  *stack = t;
+static void siftDown(struct msg_heap *h, int i) {
+  Message m = h->item[i];
+  while (1) {
+    int child = 2 * i + 1;
+    if (child >= h->size)
+      break;
+    if (child + 1 < h->size && h->before(h->item[child + 1], h->item[child]))
+      child++;
+    if (!h->before(h->item[child], m))
+      break;
+    heapPlace(h, h->item[child], i);
+    i = child;
+  }
+  heapPlace(h, m, i);
 }
 
-Thread pop(Thread *stack) {
-  Thread t = *stack;
-  *stack = t->next;
-  return t;
+static void heapInsert(Message m, struct msg_heap *h) {
+  heapPlace(h, m, h->size++);
+  siftUp(h, m->heapIndex);
 }
 
-static int remove(Msg m, Msg *queue) {
-  Msg prev = NULL, q = *queue;
-  while (q && (q != m)) {
-    prev = q;
-    q = q->next;
+static Message heapPop(struct msg_heap *h) {
+  Message m;
+  if (h->size == 0)
+    PANIC("Empty queue"); // Empty queue, kernel panic!!!
+  m = HEAP_TOP(h);
+  if (--h->size > 0) {
+    heapPlace(h, h->item[h->size], 0);
+    siftDown(h, 0);
   }
-  if (q) {
-    if (prev)
-      prev->next = q->next;
-    else
-      *queue = q->next;
-    return 1;
+  return m;
+}
+
+static int heapRemove(Message m, struct msg_heap *h) {
+  int i = m->heapIndex;
+  if (i < 0 || i >= h->size || h->item[i] != m)
+    return 0;
+  if (i < --h->size) {
+    Message last = h->item[h->size];
+    heapPlace(h, last, i);
+    siftDown(h, i);
+    siftUp(h, last->heapIndex);
   }
-  return 0;
+  return 1;
 }
 
-TIMER_COMPARE_INTERRUPT {
-  Time now;
+void enqueueByBaseline(Message p, struct msg_heap *queue) {
+  p->order = queueOrder++;
+  p->state = MSG_TIMED;
+  heapInsert(p, queue);
+}
 
-  TIMER_CCLR();
-#ifdef __USE_SAFE_TIMER
-  TIM_Cmd(TIM5, DISABLE);
-#endif
-  TIMERGET(now);
+void enqueueByDeadline(Message p, struct ready_queue *queue) {
+  p->state = MSG_READY;
+  p->order = queueOrder++;
+  if (p->infinite) {
+    p->next = NULL;
+    p->prev = queue->tail;
+    if (queue->head)
+      queue->tail->next = p;
+    else
+      queue->head = p;
+    queue->tail = p;
+  } else
+    heapInsert(p, &queue->timed);
+}
 
-#ifdef __TRACE_TIMER1
-  DUMP("In TIMER_COMPARE_INTERRUPT()!");
-  DUMP(" Counter = ");
-  DUMPD(TIM_GetCounter(TIM5));
-  DUMP(", Exception = ");
-  DUMPD(__CURRENT_EXCEPTION);
-  DUMP(", timerQ = ");
-  DUMPH((unsigned int)timerQ);
-  DUMP("\n\r");
-#endif
+/* first message in EDF order, or NULL */
+static Message readyTop(struct ready_queue *queue) {
+  return queue->timed.size ? HEAP_TOP(&queue->timed) : queue->head;
+}
 
-  while (timerQ && (timerQ->baseline - now <= 0))
-    enqueueByDeadline(dequeue(&timerQ), &msgQ);
-  if (timerQ) {
+static Message dequeueReady(struct ready_queue *queue) {
+  Message m;
+  if (queue->timed.size)
+    return heapPop(&queue->timed);
+  m = queue->head;
+  if (!m)
+    PANIC("Empty queue"); // Empty queue, kernel panic!!!
+  queue->head = m->next;
+  if (queue->head)
+    queue->head->prev = NULL;
+  else
+    queue->tail = NULL;
+  return m;
+}
+
+static void removeReady(Message m, struct ready_queue *queue) {
+  if (!m->infinite) {
+    heapRemove(m, &queue->timed);
+    return;
+  }
+  if (m->prev)
+    m->prev->next = m->next;
+  else
+    queue->head = m->next;
+  if (m->next)
+    m->next->prev = m->prev;
+  else
+    queue->tail = m->prev;
+}
+
+#ifdef __USE_TIMER_WHEEL
+int enqueueByWheel(Message p, Time now) {
+  int slot;
+  if (wheelCount == 0)
+    wheelTime = now;
+  if ((uint32_t)TIME_DIFF(p->baseline, wheelTime) >= __TIMER_WHEEL_SLOTS)
+    return 0; // beyond the horizon
+  p->order = queueOrder++;
+  p->state = MSG_TIMED;
+  p->next = NULL;
+  slot = p->baseline & WHEEL_MASK;
+  p->prev = wheelTail[slot];
+  if (wheelHead[slot])
+    wheelTail[slot]->next = p;
+  else {
+    wheelHead[slot] = p;
+    wheelBusy[slot >> 5] |= 1u << (slot & 31);
+  }
+  wheelTail[slot] = p;
+  wheelCount++;
+  return 1;
+}
+
+static Message wheelNext(void) {
+  int start = wheelTime & WHEEL_MASK;
+  int i;
+  if (wheelCount == 0)
+    return NULL;
+  for (i = 0; i <= WHEEL_WORDS; i++) {
+    int w = ((start >> 5) + i) % WHEEL_WORDS;
+    uint32_t bits = wheelBusy[w];
+    if (i == 0)
+      bits &= ~0u << (start & 31);
+    else if (i == WHEEL_WORDS)
+      bits &= ~(~0u << (start & 31)); // wrapped around to the first word
+    if (bits)
+      return wheelHead[(w << 5) + __builtin_ctz(bits)];
+  }
+  return NULL;
+}
+
+static void wheelRemove(Message m) {
+  int slot = m->baseline & WHEEL_MASK;
+  if (m->prev)
+    m->prev->next = m->next;
+  else
+    wheelHead[slot] = m->next;
+  if (m->next)
+    m->next->prev = m->prev;
+  else
+    wheelTail[slot] = m->prev;
+  if (!wheelHead[slot])
+    wheelBusy[slot >> 5] &= ~(1u << (slot & 31));
+  wheelCount--;
+}
+#endif
+
+#if __IDLE_SLACK > 0
+#define COALESCE_MAX 8 // timed messages considered for one shared wakeup
+
+/* how long m may be released after its baseline: at most half its window */
+static Time postpone(Message m) {
+  if (!m->infinite && TIME_DIFF(m->deadline, m->baseline) / 2 < __IDLE_SLACK)
+    return TIME_DIFF(m->deadline, m->baseline) / 2;
+  return __IDLE_SLACK;
+}
+
+/* add the messages of timerQ subheap i with baselines up to last to found */
+static int gather(Message *found, int n, Time last, int i) {
+  if (i >= timerQ.size || TIME_BEFORE(last, timerQ.item[i]->baseline))
+    return n;
+  if (n == COALESCE_MAX)
+    return n + 1; // too many to check
+  found[n++] = timerQ.item[i];
+  n = gather(found, n, last, 2 * i + 1);
+  return gather(found, n, last, 2 * i + 2);
+}
+
+/*
+ * Time to wake up for m, the earliest timed message. The wakeup is put off
+ * to the latest baseline that lets the timed messages due by then share it
+ * without any of them waiting more than postpone() past its own baseline.
+ */
+static Time wakeup(Message m) {
+  Message found[COALESCE_MAX + 1];
+  Time wake = m->baseline, limit = TIME_ADD(wake, postpone(m));
+  int n, i;
+
+  n = gather(found, 0, TIME_ADD(wake, __IDLE_SLACK), 0);
+#ifdef __USE_TIMER_WHEEL
+  i = 0;
+  while (i <= __IDLE_SLACK && i < __TIMER_WHEEL_SLOTS && n <= COALESCE_MAX) {
+    int slot = TIME_ADD(wake, i) & WHEEL_MASK;
+    uint32_t bits = wheelBusy[slot >> 5] >> (slot & 31);
+    Message w;
+    if (!(bits & 1)) { // skip to the next busy slot in this word, or the next
+      i += bits ? __builtin_ctz(bits) : 32 - (slot & 31);
+      continue;
+    }
+    for (w = wheelHead[slot]; w && n <= COALESCE_MAX; w = w->next)
+      if (w->baseline == TIME_ADD(wake, i))
+        found[n++] = w;
+    i++;
+  }
+#endif
+  if (n > COALESCE_MAX)
+    return wake;
+
+  while (1) {
+    Time next = limit;
+    int any = 0;
+    for (i = 0; i < n; i++) {
+      if (TIME_BEFORE(wake, found[i]->baseline) &&
+          !TIME_BEFORE(next, found[i]->baseline)) {
+        next = found[i]->baseline;
+        any = 1;
+      }
+    }
+    if (!any)
+      return wake;
+    wake = next;
+    for (i = 0; i < n; i++)
+      if (found[i]->baseline == wake &&
+          TIME_BEFORE(TIME_ADD(wake, postpone(found[i])), limit))
+        limit = TIME_ADD(wake, postpone(found[i]));
+  }
+}
+#else
+#define wakeup(m) ((m)->baseline)
+#endif
+
+/* earliest pending timed message, or NULL */
+static Message nextTimer(void) {
+  Message m = timerQ.size ? HEAP_TOP(&timerQ) : NULL;
+#ifdef __USE_TIMER_WHEEL
+  Message w = wheelNext();
+  if (w && (!m || byBaseline(w, m)))
+    m = w;
+#endif
+  return m;
+}
+
+static void removeTimer(Message m) {
+#ifdef __USE_TIMER_WHEEL
+  if (!heapRemove(m, &timerQ))
+    wheelRemove(m);
+#else
+  heapRemove(m, &timerQ);
+#endif
+}
+
+Message dequeue(Message *queue) {
+  Message m = *queue;
+  if (m)
+    *queue = m->next;
+  else
+    PANIC("Empty queue"); // Empty queue, kernel panic!!!
+  return m;
+}
+
+Message dequeue_pool(Message *queue) {
+  Message m = *queue;
+  if (m)
+    *queue = m->next;
+  else
+    PANIC("Empty pool"); // Empty pool, kernel panic!!!
+  return m;
+}
+
+#ifdef __TRACE_BUFFER
+static void traceWrite(int event, uint32_t id) {
+  struct trace_record *r = &traceRing[traceHead & (__TRACE_BUFFER_SIZE - 1)];
+  TIMERGET(r->time);
+  r->event = event;
+  r->thread = current->thread_no + 1;
+  r->id = id;
+  traceHead++;
+}
+
+/* append a record; call with interrupts disabled or from a handler */
+static void trace(int event, uint32_t id) {
+  if (traceHead - traceTail + (traceLost ? 2 : 1) > __TRACE_BUFFER_SIZE) {
+    traceLost++;
+    return;
+  }
+  if (traceLost) {
+    traceWrite(TRACE_LOST, traceLost);
+    traceLost = 0;
+  }
+  traceWrite(event, id);
+}
+
+/*
+ * Move at most one byte of trace output to USART1. A new frame is only
+ * started while the serial driver has nothing queued for transmission.
+ * Returns nonzero while there is trace output left to send.
+ */
+static int traceDrain(void) {
+  static uint8_t frame[TRACE_FRAME_SIZE];
+  static int sent = TRACE_FRAME_SIZE; // bytes of frame[] already sent
+  int busy;
+
+  DISABLE();
+  if (sent == TRACE_FRAME_SIZE && traceTail != traceHead &&
+      TRACE_PORT_IDLE()) {
+    struct trace_record *r =
+        &traceRing[traceTail & (__TRACE_BUFFER_SIZE - 1)];
+    int i;
+    frame[0] = TRACE_FRAME_START;
+    frame[1] = r->time;
+    frame[2] = r->time >> 8;
+    frame[3] = r->time >> 16;
+    frame[4] = r->time >> 24;
+    frame[5] = r->event;
+    frame[6] = r->thread;
+    frame[7] = r->id;
+    frame[8] = r->id >> 8;
+    frame[9] = r->id >> 16;
+    frame[10] = r->id >> 24;
+    frame[11] = 0;
+    for (i = 1; i < 11; i++)
+      frame[11] ^= frame[i];
+    traceTail++;
+    sent = 0;
+  }
+  if (sent < TRACE_FRAME_SIZE && TRACE_PORT_READY()) {
+    TRACE_PORT_SEND(frame[sent]);
+    sent++;
+  }
+  busy = sent < TRACE_FRAME_SIZE || traceTail != traceHead;
+  ENABLE(1);
+  return busy;
+}
+#endif
+
+/*
+ * Return m to the back of msgPool, invalidating every outstanding handle to
+ * it. Reusing blocks in FIFO order puts off the wrap of its generation.
+ */
+static void recycle(Message m) {
+  m->state = MSG_FREE;
+  m->generation++;
+  m->to->pending--;
+  poolUsed--;
+  m->next = NULL;
+  if (msgPool)
+    msgPoolTail->next = m;
+  else
+    msgPool = m;
+  msgPoolTail = m;
+}
+
+void push(Thread t, Thread *stack) {
+  t->next = *stack;
+  *stack = t;
+}
+
+Thread pop(Thread *stack) {
+  Thread t = *stack;
+  *stack = t->next;
+  return t;
+}
+
+/*
+ * Move the timed messages whose baselines have passed by now to msgQ, and
+ * return the earliest one still pending, or NULL.
+ */
+static Message expire(Time now) {
+  Message m;
+
+  while ((m = nextTimer()) && !TIME_BEFORE(now, m->baseline)) {
+    removeTimer(m);
+    TRACE(TRACE_EXPIRE, METHOD_ID(m->method));
+    enqueueByDeadline(m, &msgQ);
+  }
+#ifdef __USE_TIMER_WHEEL
+  wheelTime = TIME_ADD(now, 1); // every slot up to now has been drained
+#endif
+  return m;
+}
+
+TIMER_COMPARE_INTERRUPT {
+  Time now;
+  Message m;
+
+  IRQ_BEGIN(start);
+
+  TIMER_CCLR();
+  TIMER_EPOCH();
+  TRACE(TRACE_IRQ_ENTER, IRQ_TIM5);
+#ifdef __USE_SAFE_TIMER
+  TIM_Cmd(TIM5, DISABLE);
+#endif
+  TIMERGET(now);
+  IDLE_END(now);
+
+  if ((m = expire(now))) {
 #ifdef __USE_FUTURE_CHECK_TIMER
-    Time timcount = TIM_GetCounter(TIM5);
-    if (timerQ->baseline < timcount)
+    Time timcount;
+    TIMERGET(timcount);
+    if (TIME_BEFORE(m->baseline, timcount))
       RED_ALERT(); // Next event is in the past!
 #endif
-    TIMERSET(timerQ);
+    TIMERSET(wakeup(m));
   }
-#ifdef __TRACE_SCHEDULE
-  DUMP("schedule() in TIMER_COMPARE_INTERRUPT()");
-  DUMP("\n\r");
-#endif
 #ifdef __USE_SAFE_TIMER
   TIM_Cmd(TIM5, ENABLE);
 #endif
 
+  IRQ_END(IRQ_TIM5, start);
   schedule();
+  TRACE(TRACE_IRQ_EXIT, IRQ_TIM5);
 }
 
 /* context switching */
 
+#ifdef __TINYTIMBER_POSIX
+/*
+ * Switch at once, also from a signal handler. The switched-out context
+ * keeps its signal frame and returns from the handler when resumed, so
+ * posixHandler is restored from this frame, and a context that resumes in
+ * thread mode is the only one that enables interrupts.
+ */
+void dispatch(Thread next) {
+  Thread prev = current;
+  int wasHandler = posixHandler;
+
+  TRACE(TRACE_DISPATCH, next->thread_no + 1);
+
+  current = next;
+  posixHandler = 0; // a new thread starts in run(), in thread mode
+  swapcontext(&prev->context, &next->context);
+  posixHandler = wasHandler;
+
+  ENABLE(THREADMODE());
+}
+#else
 __attribute__((naked)) void __svc_dispatch(Thread next) {
   upcoming = next;
   asm volatile("svc 0x10\n"
@@ -500,14 +1459,7 @@ __attribute__((naked)) void __pendSV_dispatch(Thread next) {
 }
 
 void dispatch(Thread next) {
-#ifdef __TRACE_DISPATCH
-  DUMP("Entered dispatch(): ");
-  DUMP("thread #");
-  DUMPD(next->thread_no);
-  DUMP(", mode = ");
-  DUMPD(__CURRENT_EXCEPTION);
-  DUMP("\n\r");
-#endif
+  TRACE(TRACE_DISPATCH, next->thread_no + 1);
 
   if (THREADMODE()) {
     __svc_dispatch(next);
@@ -517,162 +1469,334 @@ void dispatch(Thread next) {
 
   ENABLE(1);
 }
+#endif
+
+#ifdef __USE_METHOD_STATS
+static int bucket(Time t) {
+  int b;
+  if (t <= 0)
+    return 0;
+  b = 32 - __builtin_clz((uint32_t)t);
+  return b < __STATS_BUCKETS ? b : __STATS_BUCKETS - 1;
+}
+
+/* record the completion of m, which started executing at time started */
+static void recordStats(Message m, Time started) {
+  MethodStats *s;
+  Time now;
+  int i = ((uintptr_t)m->method >> 1) & (__METHOD_STATS_SLOTS - 1);
+  int probes = 0;
+
+  TIMERGET(now);
+  while (methodStats[i].method != m->method) {
+    if (!methodStats[i].method) {
+      methodStats[i].method = m->method;
+      break;
+    }
+    if (++probes == __METHOD_STATS_SLOTS) {
+      methodStatsLost++;
+      return;
+    }
+    i = (i + 1) & (__METHOD_STATS_SLOTS - 1);
+  }
+  s = &methodStats[i];
+  s->runs++;
+  if (!m->infinite && TIME_BEFORE(m->deadline, now))
+    s->misses++;
+  s->latency[bucket(TIME_DIFF(started, m->baseline))]++;
+  s->execution[bucket(TIME_DIFF(now, started))]++;
+}
+#endif
 
 static void run(void) {
   while (1) {
-#ifdef __TRACE_RUN
-    DUMP("Entered run(): ");
-    DUMP("thread #");
-    DUMPD(current->thread_no);
-    DUMP(", Exception = ");
-    DUMPD(__CURRENT_EXCEPTION);
-    DUMP("\n\r");
+    Message this = current->msg =
+        dequeueReady(&msgQ); // Get first pending message
+    Message oldMsg;
+#ifdef __USE_METHOD_STATS
+    Time started;
+    TIMERGET(started);
 #endif
 
-    Msg this = current->msg = dequeue(&msgQ); // Get first pending message
-    Msg oldMsg;
-
-#ifdef __TRACE_RUN
-    DUMP("Dequeue in run() done:");
-    DUMP("thread #");
-    DUMPD(current->thread_no);
-    DUMP(", method = ");
-    DUMPH((unsigned int)this->method);
-    DUMP("\n\r");
-#endif
+    this->state = MSG_ACTIVE;
+    this->thread = current;
+    TRACE(TRACE_RUN, METHOD_ID(this->method));
 
     ENABLE(1);
     SYNC(this->to, this->method, this->arg);
+#ifdef __TINYTIMBER_SIM
+    simCharge(simCost(this->method));
+#endif
     DISABLE();
+    TRACE(TRACE_DONE, METHOD_ID(this->method));
 
-    insert(this, &msgPool);
+    if (current->msg) { // not aborted while blocked
+#ifdef __USE_METHOD_STATS
+      recordStats(this, started);
+#endif
+      if (this->period)
+        rearm(this);
+      else
+        recycle(this);
+    }
 
     oldMsg = activeStack->next->msg;
-    if (!msgQ || (oldMsg && (msgQ->deadline - oldMsg->deadline > 0))) {
+    if (!readyTop(&msgQ) || (oldMsg && earlier(oldMsg, readyTop(&msgQ)))) {
       Thread t;
       push(pop(&activeStack), &threadPool);
       t = activeStack; // can't be NULL, may be &thread0
       while (t->waitsFor)
         t = t->waitsFor->ownedBy;
-#ifdef __TRACE_DISPATCH
-      DUMP("dispatch() in run()");
-      DUMP("\n\r");
-#endif
       dispatch(t);
     }
   }
 }
 
 static void idle(void) {
-#ifdef __TRACE_SCHEDULE
-  DUMP("schedule() in idle()");
-  DUMP("\n\r");
-#endif
   schedule();
   while (1) {
     ENABLE(1);
+#ifdef __TRACE_BUFFER
+    if (traceDrain())
+      continue;
+#endif
+    // Go to sleep with interrupts disabled: the interrupt that wakes the
+    // core is taken only after SLEEP, so the time idle is the time asleep.
+    DISABLE();
+#ifdef __USE_IDLE_STATS
+    TIMERGET(idleSince);
+    idling = 1;
+#endif
     SLEEP();
   }
 }
 
 static void schedule(void) {
-  Msg topMsg = activeStack->msg;
-
-#ifdef __TRACE_SCHEDULE
-  DUMP("Entered schedule(): ");
-  DUMP("msgQ = ");
-  DUMPH((unsigned int)msgQ);
-  DUMP(", topMsg = ");
-  DUMPH((unsigned int)topMsg);
-  DUMP("\n\r");
-#endif
+  Message topMsg = activeStack->msg;
+  Message next = readyTop(&msgQ);
 
-  if (msgQ && threadPool &&
-      ((!topMsg) || (msgQ->deadline - topMsg->deadline < 0))) {
+  if (next && threadPool && earlier(next, topMsg)) {
     push(pop(&threadPool), &activeStack);
 
-#ifdef __TRACE_DISPATCH
-    DUMP("dispatch() in schedule()");
-    DUMP("\n\r");
-#endif
     dispatch(activeStack);
   }
 }
 
-/* communication primitives */
-Msg async(Time bl, Time dl, Object *to, Method meth, int arg) {
-  Msg m;
+/*
+ * Queue m, whose baseline and deadline are set, on timerQ if its baseline
+ * has not yet passed and on msgQ otherwise. Returns 1 in the latter case.
+ */
+static int release(Message m) {
+  Message next;
   Time now;
-  char wasEnabled = ENABLED();
-  DISABLE();
-  m = dequeue_pool(&msgPool); // Get new message template
-  m->to = to;
-  m->method = meth;
-  m->arg = arg;
-  m->baseline = (runAsHardware ? timestamp : current->msg->baseline) + bl;
-  m->deadline = m->baseline + (dl > 0 ? dl : INFINITY);
 
 #ifdef __USE_SAFE_TIMER
   TIM_Cmd(TIM5, DISABLE);
 #endif
   TIMERGET(now);
 
-  /*	DUMP("Entered async(): ");
+  /*	DUMP("Entered release(): ");
           DUMP("bl = ");
           DUMPD(m->baseline);
           DUMP(", dl = ");
           DUMPD(m->deadline);
           DUMP(", now = ");
           DUMPD(now);
-          DUMP(", wasEnabled = ");
-          DUMPD(wasEnabled);
           DUMP(", runAsHardware = ");
           DUMPD(runAsHardware);
           DUMP("\n\r"); */
 
-  if (m->baseline - now > 0) { // baseline has not yet passed
-#ifdef __TRACE_ASYNC1
-    DUMP("enqueueByBaseline() in async()");
-    DUMP("\n\r");
+  if (TIME_BEFORE(now, m->baseline)) { // baseline has not yet passed
+#ifdef __USE_TIMER_WHEEL
+    if (!enqueueByWheel(m, now))
 #endif
-    enqueueByBaseline(m, &timerQ);
+      enqueueByBaseline(m, &timerQ);
+    next = nextTimer();
 #ifdef __USE_FUTURE_CHECK_TIMER
-    if (timerQ->baseline < now)
+    if (TIME_BEFORE(next->baseline, now))
       RED_ALERT(); // Next event is in the past!
 #endif
-    TIMERSET(timerQ);
+    TIMERSET(wakeup(next));
 
 #ifdef __USE_SAFE_TIMER
     TIM_Cmd(TIM5, ENABLE);
 #endif
-  } else { // m is immediately schedulable
-#ifdef __TRACE_ASYNC1
-    DUMP("enqueueByDeadline() in async()");
-    DUMP("\n\r");
-#endif
+    return 0;
+  }
+  // m is immediately schedulable
 #ifdef __USE_SAFE_TIMER
-    TIM_Cmd(TIM5, ENABLE);
+  TIM_Cmd(TIM5, ENABLE);
 #endif
-    enqueueByDeadline(m, &msgQ);
-    if (wasEnabled && threadPool &&
-        (msgQ->deadline - activeStack->msg->deadline < 0)) {
-      push(pop(&threadPool), &activeStack);
-#ifdef __TRACE_DISPATCH
-      DUMP("dispatch() in async()");
-      DUMP("\n\r");
-#endif
-      dispatch(activeStack);
-    }
+  enqueueByDeadline(m, &msgQ);
+  return 1;
+}
+
+/* re-release a periodic message that has completed, one period later */
+static void rearm(Message m) {
+  // relative to the previous baseline: no drift
+  m->baseline = TIME_ADD(m->baseline, m->period);
+  if (!m->infinite)
+    m->deadline = TIME_ADD(m->deadline, m->period);
+  release(m);
+}
+
+/* communication primitives */
+/*
+ * With data, the size bytes at data are copied into the message and meth is
+ * passed a pointer to the copy instead of arg.
+ */
+static Msg post(Time bl, Time per, Time dl, Object *to, Method meth, int arg,
+                const void *data, int size, int mayFail) {
+  Message m;
+  char wasEnabled = ENABLED();
+  if (data && (size < 0 || size > __PAYLOAD_SIZE))
+    PANIC("Message payload larger than __PAYLOAD_SIZE\n");
+  DISABLE();
+  if (!msgPool && mayFail) { // shed the message rather than panic
+    poolDropped++;
+    ENABLE(wasEnabled);
+    return NULL;
+  }
+  m = dequeue_pool(&msgPool); // Get new message template
+  if (++poolUsed > poolHighWater)
+    poolHighWater = poolUsed;
+  to->pending++;
+  TRACE(TRACE_ASYNC, METHOD_ID(meth));
+  m->to = to;
+  m->method = meth;
+  m->arg = arg;
+  if (data) {
+    const char *src = data;
+    char *dst = (char *)m->data;
+    while (size--)
+      *dst++ = *src++;
+    m->arg = (int)(intptr_t)m->data; // the host builds link with -no-pie
+  }
+  m->period = per > 0 ? per : 0;
+  m->baseline =
+      TIME_ADD(runAsHardware ? timestamp : current->msg->baseline, bl);
+  m->infinite = dl <= 0;
+  if (!m->infinite) // else never read
+    m->deadline = TIME_ADD(m->baseline, dl);
+
+  if (release(m) && wasEnabled && threadPool &&
+      earlier(readyTop(&msgQ), activeStack->msg)) {
+    push(pop(&threadPool), &activeStack);
+    dispatch(activeStack);
   }
 
   ENABLE(wasEnabled);
-  return m;
+  return HANDLE(m);
+}
+
+Msg async(Time bl, Time dl, Object *to, Method meth, int arg) {
+  return post(bl, 0, dl, to, meth, arg, NULL, 0, 0);
+}
+
+Msg try_async(Time bl, Time dl, Object *to, Method meth, int arg) {
+  return post(bl, 0, dl, to, meth, arg, NULL, 0, 1);
+}
+
+Msg periodic(Time bl, Time per, Time dl, Object *to, Method meth, int arg) {
+  return post(bl, per, dl, to, meth, arg, NULL, 0, 0);
+}
+
+Msg async_data(Time bl, Time dl, Object *to, Method meth, const void *data,
+               int size, int mayFail) {
+  return post(bl, 0, dl, to, meth, 0, data, size, mayFail);
+}
+
+#ifdef __USE_FAST_SYNC
+/*
+ * Lock and unlock an object without a critical section. An exception
+ * between LDREX and STREX clears the exclusive monitor so that the STREX
+ * fails and the test is redone, which makes test and store atomic. Both
+ * leave the work to the critical section in sync() if anyone else owns or
+ * wants the object. The host port does the same with posixMonitor.
+ */
+#ifdef __TINYTIMBER_POSIX
+static inline int fastLock(Object *to) {
+  do {
+    if (posixLoadExclusive(&to->ownedBy) || to->wantedBy) {
+      posixMonitor = MONITOR_OPEN;
+      return 0;
+    }
+  } while (!posixStoreExclusive(&to->ownedBy, NULL, current));
+  return 1;
+}
+
+static inline int fastUnlock(Object *to) {
+  do {
+    posixLoadExclusive(&to->ownedBy);
+    if (to->wantedBy) {
+      posixMonitor = MONITOR_OPEN;
+      return 0;
+    }
+  } while (!posixStoreExclusive(&to->ownedBy, current, NULL));
+  return 1;
+}
+#else
+static inline int fastLock(Object *to) {
+  volatile uint32_t *owner = (volatile uint32_t *)&to->ownedBy;
+  do {
+    if (__LDREXW(owner) || to->wantedBy) {
+      __CLREX();
+      return 0;
+    }
+  } while (__STREXW((uint32_t)current, owner));
+  return 1;
+}
+
+static inline int fastUnlock(Object *to) {
+  volatile uint32_t *owner = (volatile uint32_t *)&to->ownedBy;
+  do {
+    __LDREXW(owner);
+    if (to->wantedBy) {
+      __CLREX();
+      return 0;
+    }
+  } while (__STREXW(0, owner));
+  return 1;
+}
+#endif
+#endif
+
+/* release to and run the thread that waits for it, if any */
+static void unlock(Object *to) {
+  Thread t;
+  to->ownedBy = NULL;
+  t = to->wantedBy;
+  if (t && (t != INSTALLED_TAG)) { // we have run on someone's behalf
+    to->wantedBy = NULL;
+    t->waitsFor = NULL;
+    dispatch(t);
+  }
 }
 
 int sync(Object *to, Method meth, int arg) {
   Thread t;
   int result;
   char wasEnabled = ENABLED();
+#ifdef __USE_LOCK_STATS
+  int chain = 1;
+  Time blockedAt, resumedAt;
+#endif
+
+#ifdef __USE_FAST_SYNC
+  // an uncontended call from thread mode; handlers take the critical section
+  if (wasEnabled && THREADMODE() && fastLock(to)) {
+#ifdef __USE_LOCK_STATS
+    to->lock.syncs++;
+#endif
+    result = meth(to, arg);
+    if (!fastUnlock(to)) {
+      DISABLE();
+      unlock(to);
+      ENABLE(1);
+    }
+    return result;
+  }
+#endif
 
   DISABLE();
 
@@ -681,9 +1805,16 @@ int sync(Object *to, Method meth, int arg) {
 
   t = to->ownedBy;
   if (t) { // to is already locked
-    while (t->waitsFor)
+    while (t->waitsFor) {
       t = t->waitsFor->ownedBy;
+#ifdef __USE_LOCK_STATS
+      chain++;
+#endif
+    }
     if (t == current || !wasEnabled) { // deadlock!
+#ifdef __USE_LOCK_STATS
+      to->lock.deadlocks++;
+#endif
       ENABLE(wasEnabled);
       return -1;
     }
@@ -691,92 +1822,290 @@ int sync(Object *to, Method meth, int arg) {
       to->wantedBy->waitsFor = NULL;
     to->wantedBy = current;
     current->waitsFor = to;
-#ifdef __TRACE_DISPATCH
-    DUMP("dispatch() in sync() - already locked");
-    DUMP("\n\r");
+    TRACE(TRACE_BLOCK, t->thread_no + 1);
+#ifdef __USE_LOCK_STATS
+    to->lock.contended++;
+    if (chain > to->lock.chain)
+      to->lock.chain = chain;
+    TIMERGET(blockedAt);
 #endif
     dispatch(t);
+#ifdef __USE_LOCK_STATS
+    DISABLE();
+    TIMERGET(resumedAt);
+    to->lock.blocked += TIME_DIFF(resumedAt, blockedAt);
+#endif
     if (current->msg == NULL) { // message was aborted (when called from run)
       ENABLE(wasEnabled);
       return 0;
     }
   }
   to->ownedBy = current;
+#ifdef __USE_LOCK_STATS
+  to->lock.syncs++; // counted while locked, so the fast path can do it too
+#endif
   ENABLE(wasEnabled &&
          (to->wantedBy !=
           INSTALLED_TAG)); // don't enable interrupts if running as handler
   result = meth(to, arg);
   DISABLE();
-  to->ownedBy = NULL;
-  t = to->wantedBy;
-  if (t && (t != INSTALLED_TAG)) { // we have run on someone's behalf
-    to->wantedBy = NULL;
-    t->waitsFor = NULL;
-#ifdef __TRACE_DISPATCH
-    DUMP("dispatch() in sync() - run on someone's behalf");
-    DUMP("\n\r");
-#endif
-    dispatch(t);
-  }
+  unlock(to);
   ENABLE(wasEnabled);
   return result;
 }
 
-void ABORT(Msg m) {
+/* the message denoted by handle h, or NULL if h is stale */
+static Message lookup(Msg h) {
+  int i = HANDLE_INDEX(h);
+  if (i < 0 || i >= NMSGS)
+    return NULL;
+  if (messages[i].state == MSG_FREE ||
+      messages[i].generation != HANDLE_GENERATION(h))
+    return NULL;
+  return &messages[i];
+}
+
+static void abort_message(Message m) {
+  switch (m->state) {
+  case MSG_TIMED:
+    TRACE(TRACE_ABORT, METHOD_ID(m->method));
+    removeTimer(m);
+    recycle(m);
+    break;
+  case MSG_READY:
+    TRACE(TRACE_ABORT, METHOD_ID(m->method));
+    removeReady(m, &msgQ);
+    recycle(m);
+    break;
+  case MSG_ACTIVE: // abort only if still waiting to lock its receiver
+    if ((m->thread != current) && (m->thread->msg == m) &&
+        (m->thread->waitsFor == m->to)) {
+      TRACE(TRACE_ABORT, METHOD_ID(m->method));
+      m->thread->msg = NULL;
+      recycle(m);
+    }
+    break;
+  }
+}
+
+void ABORT(Msg h) {
+  Message m;
   char wasEnabled = ENABLED();
   DISABLE();
+  if ((m = lookup(h)))
+    abort_message(m);
+  ENABLE(wasEnabled);
+}
 
-  if (remove(m, &timerQ) || remove(m, &msgQ))
-    insert(m, &msgPool);
-  else {
-    Thread t = activeStack;
-    while (t) {
-      if ((t != current) && (t->msg == m) && (t->waitsFor == m->to)) {
-        t->msg = NULL;
-        insert(m, &msgPool);
-        break;
-      }
-      t = t->next;
-    }
+void CANCEL(Msg h) {
+  Message m;
+  char wasEnabled = ENABLED();
+  DISABLE();
+  if ((m = lookup(h))) {
+    m->period = 0; // not re-armed if currently executing
+    abort_message(m);
   }
   ENABLE(wasEnabled);
 }
 
-void T_RESET(Timer *t) {
-  t->accum = ENABLED() ? current->msg->baseline : timestamp;
+void SET_PERIOD(Msg h, Time per) {
+  Message m;
+  char wasEnabled = ENABLED();
+  DISABLE();
+  if ((m = lookup(h)) && m->period && per > 0)
+    m->period = per;
+  ENABLE(wasEnabled);
 }
 
-Time T_SAMPLE(Timer *t) {
-  return (ENABLED() ? current->msg->baseline : timestamp) - t->accum;
+int POOL_USED(void) { return poolUsed; }
+
+int POOL_HIGHWATER(void) { return poolHighWater; }
+
+int POOL_DROPPED(void) { return poolDropped; }
+
+int THREADS(void) { return NTHREADS; }
+
+int STACK_SIZE(int i) {
+  if (i < 0 || i >= NTHREADS)
+    return 0;
+  return threads[i].stackSize;
 }
 
-Time CURRENT_OFFSET(void) {
-  Time now;
+/* stacks grow down, so the paint left at the bottom was never reached */
+int STACK_HIGHWATER(int i) {
+  int unused = 0;
+  if (i < 0 || i >= NTHREADS)
+    return 0;
+  while (unused < threads[i].stackSize / sizeof(STACK_T) &&
+         threads[i].stack[unused] == STACK_PAINT)
+    unused++;
+  return threads[i].stackSize - unused * sizeof(STACK_T);
+}
+
+#ifdef __USE_METHOD_STATS
+int METHOD_STATS(int i, MethodStats *s) {
   char wasEnabled = ENABLED();
+  if (i < 0 || i >= __METHOD_STATS_SLOTS)
+    return 0;
+  DISABLE();
+  *s = methodStats[i];
+  ENABLE(wasEnabled);
+  return s->method != NULL;
+}
+
+void METHOD_STATS_RESET(void) {
+  static const MethodStats empty;
+  int i;
+  char wasEnabled = ENABLED();
+  DISABLE();
+  for (i = 0; i < __METHOD_STATS_SLOTS; i++)
+    methodStats[i] = empty;
+  methodStatsLost = 0;
+  ENABLE(wasEnabled);
+}
+#endif
+
+#ifdef __USE_IDLE_STATS
+void IDLE_STATS(IdleStats *s) {
+  char wasEnabled = ENABLED();
+  Time now;
   DISABLE();
   TIMERGET(now);
+  *s = idleStats;
+  s->elapsed = TIME_DIFF(now, idleStatsStart);
   ENABLE(wasEnabled);
-  return now - (wasEnabled ? current->msg->baseline : timestamp);
+}
+
+void IDLE_STATS_RESET(void) {
+  static const IdleStats empty;
+  char wasEnabled = ENABLED();
+  DISABLE();
+  idleStats = empty;
+  TIMERGET(idleStatsStart);
+  ENABLE(wasEnabled);
+}
+#endif
+
+#ifdef __USE_IRQ_STATS
+int IRQ_STATS(enum Vector i, IrqStats *s) {
+  char wasEnabled = ENABLED();
+  if (i < 0 || i >= N_VECTORS)
+    return 0;
+  DISABLE();
+  *s = irqStats[i];
+  ENABLE(wasEnabled);
+  s->worst = CYCLES_NS(s->worst);
+  return s->entries != 0;
+}
+
+void IRQ_STATS_RESET(void) {
+  static const IrqStats empty;
+  char wasEnabled = ENABLED();
+  int i;
+  DISABLE();
+  for (i = 0; i < N_VECTORS; i++)
+    irqStats[i] = empty;
+  ENABLE(wasEnabled);
+}
+#endif
+
+#ifdef __USE_SWITCH_STATS
+void SWITCH_STATS(SwitchStats *s) {
+  char wasEnabled = ENABLED();
+  uint64_t cycles;
+  DISABLE();
+  s->switches = switchStats.switches;
+  s->worst = switchStats.worst;
+  cycles = switchStats.cycles;
+  ENABLE(wasEnabled);
+  s->mean = s->switches ? CYCLES_NS(cycles / s->switches) : 0;
+  s->worst = CYCLES_NS(s->worst);
+}
+
+void SWITCH_STATS_RESET(void) {
+  char wasEnabled = ENABLED();
+  DISABLE();
+  switchStats.switches = 0;
+  switchStats.worst = 0;
+  switchStats.cycles = 0;
+  ENABLE(wasEnabled);
+}
+#endif
+
+#ifdef __USE_LOCK_STATS
+void lock_stats(Object *obj, LockStats *s) {
+  char wasEnabled = ENABLED();
+  DISABLE();
+  *s = obj->lock;
+  ENABLE(wasEnabled);
+}
+
+void lock_stats_reset(Object *obj) {
+  static const LockStats empty;
+  char wasEnabled = ENABLED();
+  DISABLE();
+  obj->lock = empty;
+  ENABLE(wasEnabled);
+}
+#endif
+
+/*
+ * The current baseline extended to 64 bits, and the current time as well
+ * in *now. The baseline lies in the past, less than 2^31 ticks ago.
+ */
+static LongTime longBaseline(LongTime *now) {
+  Time bl;
+  char wasEnabled = ENABLED();
+  DISABLE();
+  LONGTIMERGET(*now);
+  ENABLE(wasEnabled);
+  bl = wasEnabled ? current->msg->baseline : timestamp;
+  return *now - TIME_DIFF(*now, bl);
+}
+
+void T_RESET(Timer *t) {
+  LongTime now;
+  t->accum = longBaseline(&now);
+}
+
+LongTime T_SAMPLE(Timer *t) {
+  LongTime now;
+  return longBaseline(&now) - t->accum;
+}
+
+LongTime CURRENT_OFFSET(void) {
+  LongTime now, bl = longBaseline(&now);
+  return now - bl;
 }
 
 /* initialization */
 static void initialize(void) {
   int i;
+  STACK_T *sp;
 
   for (i = 0; i < NMSGS - 1; i++)
     messages[i].next = &messages[i + 1];
   messages[NMSGS - 1].next = NULL;
 
+  for (i = 0; i < NMSGS; i++)
+    messages[i].heapIndex = -1;
+
   for (i = 0; i < NTHREADS - 1; i++)
     threads[i].next = &threads[i + 1];
   threads[NTHREADS - 1].next = NULL;
 
-  for (i = 0; i < NTHREADS; i++) {
+  for (i = 0, sp = stacks; i < NTHREADS; i++) {
+    int j;
+    for (j = 0; j < stackSizes[i] / sizeof(STACK_T); j++)
+      sp[j] = STACK_PAINT;
+    threads[i].stack = sp;
+    threads[i].stackSize = stackSizes[i];
     threads[i].thread_no = i;
     SETCONTEXT(threads[i].context);
-    SETSTACK(&threads[i].context, &stacks[i]);
+    SETSTACK(&threads[i].context, sp, stackSizes[i]);
     SETPC(&threads[i].context, run);
     threads[i].waitsFor = NULL;
+    sp += stackSizes[i] / sizeof(STACK_T);
   }
 
   thread0.thread_no = -1;
@@ -791,32 +2120,47 @@ static void initialize(void) {
   DUMP("\n\r");
 
   TIMER_INIT();
+
+#ifndef __TINYTIMBER_POSIX
+  for (i = 0; i < N_VECTORS; i++)
+    if (mtable[i])
+      NVIC_EnableIRQ((IRQn_Type)i); // installed before the kernel was ready
+  started = 1;
+#endif
 }
 
-void install(Object *obj, Method m, enum Vector i) {
+void install(Object *obj, Method m, enum Vector i, int prio) {
   if (i >= 0 && i < N_VECTORS) {
     char wasEnabled = ENABLED();
+    if (i == IRQ_TIM5)
+      PANIC("Device IRQ used by the kernel timer ...");
+    if (prio < 0 || prio > __IRQ_PRIORITY)
+      PANIC("Device IRQ priority not supported ...");
     DISABLE();
-    switch (i) {
-    case IRQ_USART1:
-      *((void (**)(void))USART1_IRQ_VECTOR) = vect_USART1;
-      break;
-
-    case IRQ_CAN1:
-      *((void (**)(void))CAN1_IRQ_VECTOR) = vect_CAN1;
-      break;
-
-    case IRQ_EXTI9_5:
-      *((void (**)(void))EXTI9_5_IRQ_VECTOR) = vect_EXTI9_5;
-      break;
-
-    default:
-      PANIC("Device IRQ not supported ...");
-    }
     otable[i] = obj;
     mtable[i] = m;
+    ptable[i] = prio;
     obj->wantedBy = INSTALLED_TAG; // Mark object as subject to synchronization
                                    // by interrupt disabling
+#ifdef __TINYTIMBER_POSIX
+    if (!posixSignalOf[i]) {
+      struct sigaction sa;
+      int sig = SIGRTMIN + posixSignalsUsed;
+      if (sig > SIGRTMAX || posixSignalsUsed == 64)
+        PANIC("Out of signals for device IRQs ...");
+      posixVectorOf[posixSignalsUsed++] = i;
+      sa.sa_handler = posixInterruptSignal;
+      sa.sa_flags = SA_RESTART;
+      posixSignals(&sa.sa_mask); // handlers run with interrupts disabled
+      sigaction(sig, &sa, NULL);
+      posixSignalOf[i] = sig;
+    }
+#else
+    *((void (**)(void))IRQ_VECTOR(i)) = vect_IRQ;
+    NVIC_SetPriority((IRQn_Type)i, prio);
+    if (started) // else tinytimber enables it
+      NVIC_EnableIRQ((IRQn_Type)i);
+#endif
     ENABLE(wasEnabled);
   }
 }
@@ -829,10 +2173,6 @@ int tinytimber(Object *obj, Method meth, int arg) {
     runAsHardware = 1;
     ASYNC(obj, meth, arg);
     runAsHardware = 0;
-#ifdef __TRACE_SCHEDULE
-    DUMP("schedule() in tinytimber()");
-    DUMP("\n\r");
-#endif
     schedule();
   }
   idle();
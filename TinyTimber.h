@@ -45,34 +45,95 @@
 
 #include "stm32f4xx.h"
 
+#if defined(__TINYTIMBER_SIM) && !defined(__TINYTIMBER_POSIX)
+#define __TINYTIMBER_POSIX // the simulator runs on the POSIX port
+#endif
+
+#ifdef __TINYTIMBER_POSIX
+#include <unistd.h> // declares sync(2), so include it before the rename
+#define sync tinytimber_sync
+#endif
+
 #define __USE_LOCAL_SBRK
 //#define __USE_SAFE_TIMER
+//#define __USE_TIMER_WHEEL
 #define __USE_FUTURE_CHECK_TIMER
+#define __USE_FAST_SYNC
+//#define __USE_METHOD_STATS
+//#define __USE_LOCK_STATS
+//#define __USE_IDLE_STATS
+//#define __USE_IRQ_STATS
+//#define __USE_SWITCH_STATS
+
+#ifdef __TINYTIMBER_POSIX
+#undef __USE_SWITCH_STATS // the host switches by swapcontext(), not PendSV
+#endif
+
+#define __TIMER_WHEEL_SLOTS 256 // timer wheel horizon in ticks (power of 2)
+#define __METHOD_STATS_SLOTS 16 // methods tracked by __USE_METHOD_STATS (power of 2)
+#define __STATS_BUCKETS 16      // log2 histogram buckets per method
+#define __PAYLOAD_SIZE 16       // bytes a message can carry, see ASYNC_DATA
+#define __SIM_COST_SLOTS 32     // methods given a cost with SIM_COST
+
+#ifndef __IDLE_SLACK
+#define __IDLE_SLACK 0 // ticks a timed release may wait to share a wakeup
+#endif
+
+#ifndef NMSGS
+#define NMSGS 30 // size of the message pool
+#endif
+
+// One X(bytes) per thread, giving the size of its stack (a multiple of 8).
+#ifndef __THREAD_STACKS
+#ifdef __TINYTIMBER_POSIX
+#define __THREAD_STACKS(X) X(65536) X(65536) X(65536) X(65536) // signal frames
+#else
+#define __THREAD_STACKS(X) X(8192) X(8192) X(8192) X(8192)
+#endif
+#endif
 
 #define __ENABLED_PRIORITY	3
 #define __DISABLED_PRIORITY	1
 #define __IRQ_PRIORITY		2
 
-//#define __TRACE_DISPATCH
-//#define __TRACE_RUN
-//#define __TRACE_TIMER
-//#define __TRACE_SCHEDULE
-//#define __TRACE_ASYNC
+//#define __TRACE_BUFFER
+
+#define __TRACE_BUFFER_SIZE 256 // kernel trace records kept in RAM (power of 2)
 
 extern int doIRQSchedule;
 
 //      Abstract type, used in the definition of Object.
 struct thread_block;
 
+#ifdef __USE_LOCK_STATS
+//      Contention record of an object, updated by SYNC.
+typedef struct {
+    unsigned syncs;     // SYNC calls that ran a method on the object
+    unsigned contended; // calls that found it locked and had to wait
+    unsigned deadlocks; // calls that returned -1
+    unsigned blocked;   // total ticks the waiting callers were blocked
+    int chain;          // longest chain of lock owners followed
+} LockStats;
+#endif
+
 //      Base class of reactive objects. Every reactive object in a TinyTimber 
 //      system must be of a class that inherits this class.
 typedef struct {
     struct thread_block *ownedBy, *wantedBy;
+    int pending;
+#ifdef __USE_LOCK_STATS
+    LockStats lock;
+#endif
 } Object;
 
 //      Initialization macro for class Object. 
+#ifdef __USE_LOCK_STATS
+#define initObject() \
+        { NULL, NULL, 0, { 0 } }
+#else
 #define initObject() \
-        { NULL, NULL }
+        { NULL, NULL, 0 }
+#endif
 
 //  int SYNC( T* obj, int (*meth)(T*, A), A arg );
 //      Synchronously invoke method meth on object obj with argument arg. Type T 
@@ -83,10 +144,12 @@ typedef struct {
         sync((Object*)obj, (Method)meth, (int)arg)
 
 //      Abstract type, used in the definition of Msg
-struct msg_block;
+struct msg_handle;
 
-//      Type that identifies asynchronous messages
-typedef struct msg_block *Msg;
+//      Type that identifies asynchronous messages. A Msg is a handle rather
+//      than a pointer: once its message has run or been aborted the handle
+//      goes stale, and it never comes to denote a later message.
+typedef struct msg_handle *Msg;
 
 //      Base type for methods. Every method in a TinyTimber system should take 
 //      a first argument that is a reference to a subclass of class Object.
@@ -132,12 +195,69 @@ typedef int (*Method)(Object*, int);
 #define SEND(bl, dl, obj, meth, arg) \
         async(bl, dl, (Object*)obj, (Method)meth, (int)arg)
 
+//  Msg PERIODIC(Time bl, Time per, Time dl, T *obj, int (*meth)(T*, A), A arg);
+//      Like SEND(bl, dl, obj, meth, arg), but the message is released again
+//      every per time units after its first baseline, each time with relative
+//      deadline dl, until it is cancelled. Every release reuses the same
+//      message, so the returned handle stays valid until CANCEL.
+#define PERIODIC(bl, per, dl, obj, meth, arg) \
+        periodic(bl, per, dl, (Object*)obj, (Method)meth, (int)arg)
+
+//  Msg TRY_ASYNC(T *obj, int (*meth)(T*, A), A arg);
+//  Msg TRY_SEND(Time bl, Time dl, T *obj, int (*meth)(T*, A), A arg);
+//      Like ASYNC and SEND, but return NULL instead of halting the system
+//      when the message pool is empty. The lost message is counted in
+//      POOL_DROPPED(). Meant for interrupt handlers, which can shed input.
+#define TRY_ASYNC(obj, meth, arg) \
+        try_async((Time)0, (Time)0, (Object*)obj, (Method)meth, (int)arg)
+#define TRY_SEND(bl, dl, obj, meth, arg) \
+        try_async(bl, dl, (Object*)obj, (Method)meth, (int)arg)
+
+//  Msg ASYNC_DATA(T *obj, int (*meth)(T*, A*), A *data);
+//  Msg SEND_DATA(Time bl, Time dl, T *obj, int (*meth)(T*, A*), A *data);
+//  Msg TRY_ASYNC_DATA(T *obj, int (*meth)(T*, A*), A *data);
+//  Msg TRY_SEND_DATA(Time bl, Time dl, T *obj, int (*meth)(T*, A*), A *data);
+//      Like ASYNC, SEND, TRY_ASYNC and TRY_SEND, but copy *data into the
+//      message itself and invoke meth with a pointer to that copy. Type A
+//      can be any type of at most __PAYLOAD_SIZE bytes. The copy belongs to
+//      the message, so the sender may reuse *data at once, and it stays
+//      valid until meth returns.
+#define ASYNC_DATA(obj, meth, data) \
+        async_data((Time)0, (Time)0, (Object*)obj, (Method)meth, data, sizeof(*(data)), 0)
+#define SEND_DATA(bl, dl, obj, meth, data) \
+        async_data(bl, dl, (Object*)obj, (Method)meth, data, sizeof(*(data)), 0)
+#define TRY_ASYNC_DATA(obj, meth, data) \
+        async_data((Time)0, (Time)0, (Object*)obj, (Method)meth, data, sizeof(*(data)), 1)
+#define TRY_SEND_DATA(bl, dl, obj, meth, data) \
+        async_data(bl, dl, (Object*)obj, (Method)meth, data, sizeof(*(data)), 1)
+
+//  int PENDING(T *obj);
+//      Number of asynchronous messages to obj that have been sent but have
+//      not yet completed or been aborted.
+#define PENDING(obj) \
+        (((Object*)(obj))->pending)
+
 
 // Cortex m4 dependencies
 
-//      Type of time values (with platform-dependent resolution).
+//      Type of time values (with platform-dependent resolution). The
+//      kernel clock wraps every 2^32 ticks (11.9 hours at 10us), so absolute
+//      times such as baselines are compared by their difference, which is
+//      correct as long as they lie within 2^31 ticks of each other.
 typedef int32_t Time;
 
+//      The sum a + b and the difference a - b of two times, and whether
+//      time a comes before time b. The arithmetic is done unsigned, which
+//      wraps as the clock does; signed, it would overflow, which is
+//      undefined.
+#define TIME_ADD(a, b) ((Time)((uint32_t)(a) + (uint32_t)(b)))
+#define TIME_DIFF(a, b) ((Time)((uint32_t)(a) - (uint32_t)(b)))
+#define TIME_BEFORE(a, b) (TIME_DIFF(a, b) < 0)
+
+//      Type of the extended time that counts the wraps of the clock and
+//      never wraps itself, for durations that may span hours.
+typedef int64_t LongTime;
+
 #define __TIMER_PRESCALE    (840-1) // 10us tick @ 84 MHz, (See table 51 in F407 - Datasheet.pdf)
 
 //      Construct a Time value from an argument given in microseconds.
@@ -159,26 +279,84 @@ typedef int32_t Time;
 #define SEC_OF(t) \
         (int)((t) / ((Time)100000))
 
-enum Vector { 
-        IRQ_USART1, 
-        IRQ_CAN1,
-        IRQ_EXTI9_5,
-
-        N_VECTORS
+//      Interrupt vectors of the STM32F40x in vector table order, so that
+//      IRQ_x has the value of the CMSIS x_IRQn.
+enum Vector {
+        IRQ_WWDG, IRQ_PVD, IRQ_TAMP_STAMP, IRQ_RTC_WKUP, IRQ_FLASH, IRQ_RCC,
+        IRQ_EXTI0, IRQ_EXTI1, IRQ_EXTI2, IRQ_EXTI3, IRQ_EXTI4,
+        IRQ_DMA1_Stream0, IRQ_DMA1_Stream1, IRQ_DMA1_Stream2,
+        IRQ_DMA1_Stream3, IRQ_DMA1_Stream4, IRQ_DMA1_Stream5,
+        IRQ_DMA1_Stream6, IRQ_ADC, IRQ_CAN1_TX, IRQ_CAN1_RX0, IRQ_CAN1_RX1,
+        IRQ_CAN1_SCE, IRQ_EXTI9_5, IRQ_TIM1_BRK_TIM9, IRQ_TIM1_UP_TIM10,
+        IRQ_TIM1_TRG_COM_TIM11, IRQ_TIM1_CC, IRQ_TIM2, IRQ_TIM3, IRQ_TIM4,
+        IRQ_I2C1_EV, IRQ_I2C1_ER, IRQ_I2C2_EV, IRQ_I2C2_ER, IRQ_SPI1,
+        IRQ_SPI2, IRQ_USART1, IRQ_USART2, IRQ_USART3, IRQ_EXTI15_10,
+        IRQ_RTC_Alarm, IRQ_OTG_FS_WKUP, IRQ_TIM8_BRK_TIM12,
+        IRQ_TIM8_UP_TIM13, IRQ_TIM8_TRG_COM_TIM14, IRQ_TIM8_CC,
+        IRQ_DMA1_Stream7, IRQ_FSMC, IRQ_SDIO, IRQ_TIM5, IRQ_SPI3, IRQ_UART4,
+        IRQ_UART5, IRQ_TIM6_DAC, IRQ_TIM7, IRQ_DMA2_Stream0,
+        IRQ_DMA2_Stream1, IRQ_DMA2_Stream2, IRQ_DMA2_Stream3,
+        IRQ_DMA2_Stream4, IRQ_ETH, IRQ_ETH_WKUP, IRQ_CAN2_TX, IRQ_CAN2_RX0,
+        IRQ_CAN2_RX1, IRQ_CAN2_SCE, IRQ_OTG_FS, IRQ_DMA2_Stream5,
+        IRQ_DMA2_Stream6, IRQ_DMA2_Stream7, IRQ_USART6, IRQ_I2C3_EV,
+        IRQ_I2C3_ER, IRQ_OTG_HS_EP1_OUT, IRQ_OTG_HS_EP1_IN, IRQ_OTG_HS_WKUP,
+        IRQ_OTG_HS, IRQ_DCMI, IRQ_CRYP, IRQ_HASH_RNG, IRQ_FPU,
+
+        N_VECTORS,
+
+        IRQ_CAN1 = IRQ_CAN1_RX0 // FIFO 0 receive, the one the CAN driver uses
 };
 
 // End of target dependencies
 
 //      Prematurely aborts pending asynchronous message m.  Does nothing if m 
-//      has already begun executing. 
+//      has already begun executing, or if m is a stale handle to a message
+//      that has completed or been aborted.
 void ABORT(Msg m);
 
+//      Stops periodic message m. A pending release is aborted as by ABORT,
+//      and a release that has begun executing is not re-armed.
+void CANCEL(Msg m);
+
+//      Changes the period of periodic message m, starting with the release
+//      that follows the pending or executing one.
+void SET_PERIOD(Msg m, Time per);
+
+//      Number of messages currently taken from the message pool.
+int POOL_USED(void);
+
+//      Largest value of POOL_USED() seen since startup.
+int POOL_HIGHWATER(void);
+
+//      Number of TRY_ASYNC and TRY_SEND calls that found the pool empty.
+int POOL_DROPPED(void);
+
+//      Number of threads, as configured by __THREAD_STACKS.
+int THREADS(void);
+
+//      Stack size in bytes of thread i, 0 <= i < THREADS().
+int STACK_SIZE(int i);
+
+//      Largest number of bytes of its stack that thread i has used so far.
+int STACK_HIGHWATER(int i);
+
 // void INSTALL (T* obj, int (*meth)(T*, enum Vector), enum Vector i )
 //      Install method meth on object obj as an interrupt-handler for
 //      interrupt source i. Type T must be a struct type that inherits
 //      from Object. When an interrupt on i occurs, meth will be
-//      invoked on obj with i as its argument.
-#define INSTALL(obj,meth,i) install((Object*)obj, (Method)meth, i)
+//      invoked on obj with i as its argument. The vector is enabled in
+//      the NVIC at __IRQ_PRIORITY; IRQ_TIM5 belongs to the kernel.
+#define INSTALL(obj,meth,i) install((Object*)obj, (Method)meth, i, __IRQ_PRIORITY)
+
+// void INSTALL_PRIORITY (T* obj, int (*meth)(T*, enum Vector), enum Vector i,
+//                        int prio )
+//      As INSTALL, at NVIC priority prio. A priority more urgent than
+//      __IRQ_PRIORITY (numerically lower, down to 0) makes a fast handler,
+//      which preempts the kernel's own handlers and runs without it: meth
+//      must not send messages, call SYNC or use anything the kernel does.
+//      Less urgent priorities are masked in thread mode and rejected.
+#define INSTALL_PRIORITY(obj,meth,i,prio) \
+        install((Object*)obj, (Method)meth, i, prio)
 
 //  int TINYTIMBER ( T* obj, int (*meth)(T*, A), A arg )
 //      Start up the TinyTimber system by invoking method meth on obj with
@@ -190,7 +368,7 @@ void ABORT(Msg m);
 
 //      Built-in type of primitive baseline timers
 typedef struct {
-    Time accum;
+    LongTime accum;
 } Timer;
 
 //      Initialization macro for Timer objects
@@ -200,10 +378,99 @@ typedef struct {
 void T_RESET(Timer *t);
 
 //      Return difference between current baseline and timer t
-Time T_SAMPLE(Timer *t);
+LongTime T_SAMPLE(Timer *t);
 
 //      Return current time measured from current baseline
-Time CURRENT_OFFSET(void);
+LongTime CURRENT_OFFSET(void);
+
+#ifdef __USE_METHOD_STATS
+//      Timing record of one method, updated each time a message to it
+//      completes. Histogram bucket 0 counts values <= 0 ticks, bucket i
+//      counts values in [2^(i-1), 2^i) ticks, and the last bucket also
+//      takes everything above.
+typedef struct {
+    Method method;
+    unsigned runs;
+    unsigned misses;                     // completed after their deadline
+    unsigned latency[__STATS_BUCKETS];   // start - baseline
+    unsigned execution[__STATS_BUCKETS]; // completion - start
+} MethodStats;
+
+//      Copy the record in slot i, 0 <= i < __METHOD_STATS_SLOTS, to *s.
+//      Returns 0 if the slot is unused.
+int METHOD_STATS(int i, MethodStats *s);
+
+//      Clear all method records.
+void METHOD_STATS_RESET(void);
+#endif
+
+#ifdef __USE_IDLE_STATS
+//      Sleep record of the idle loop since startup or IDLE_STATS_RESET.
+typedef struct {
+    unsigned wakeups; // interrupts that woke the system from idle
+    Time idle;        // ticks spent asleep
+    Time elapsed;     // ticks in total
+} IdleStats;
+
+//      Copy the sleep record to *s.
+void IDLE_STATS(IdleStats *s);
+
+//      Clear the sleep record and start a new measurement.
+void IDLE_STATS_RESET(void);
+#endif
+
+#ifdef __USE_IRQ_STATS
+//      Record of one interrupt vector since startup or IRQ_STATS_RESET,
+//      IRQ_TIM5 being the kernel timer. Handler runs are measured with the
+//      cycle counter, up to the rescheduling that ends them.
+typedef struct {
+    unsigned entries; // times the handler was entered
+    uint32_t worst;   // longest handler run in nanoseconds
+} IrqStats;
+
+//      Copy the record of vector i to *s. Returns 0 if i has no entries.
+int IRQ_STATS(enum Vector i, IrqStats *s);
+
+//      Clear the records of all vectors.
+void IRQ_STATS_RESET(void);
+#endif
+
+#ifdef __USE_SWITCH_STATS
+//      Record of the context switches since startup or SWITCH_STATS_RESET,
+//      measured with the cycle counter from the entry of the switch in
+//      dispatch.s to its return to the next thread. That includes saving
+//      the FP registers of a thread that has used the FPU, and the lazy
+//      stacking that this defers, but not the hardware stacking on entry.
+typedef struct {
+    unsigned switches;
+    uint32_t mean;  // in nanoseconds
+    uint32_t worst; // in nanoseconds
+} SwitchStats;
+
+//      Copy the switch record to *s.
+void SWITCH_STATS(SwitchStats *s);
+
+//      Clear the switch record.
+void SWITCH_STATS_RESET(void);
+#endif
+
+#ifdef __USE_LOCK_STATS
+//  void LOCK_STATS( T* obj, LockStats *s )
+//      Copy the contention record of object obj to *s.
+#define LOCK_STATS(obj,s) lock_stats((Object*)obj, s)
+
+//  void LOCK_STATS_RESET( T* obj )
+//      Clear the contention record of object obj.
+#define LOCK_STATS_RESET(obj) lock_stats_reset((Object*)obj)
+#endif
+
+#ifdef __TINYTIMBER_SIM
+//      Let every run of method meth take cost ticks of simulated time, or
+//      with meth NULL, every run of a method that has no cost of its own.
+//      A method's effects happen when it starts; interrupts and more
+//      urgent messages may preempt it while its cost is being charged.
+void SIM_COST(Method meth, Time cost);
+#endif
 
 
 // -------------------------------------------------------------------
@@ -211,8 +478,30 @@ Time CURRENT_OFFSET(void);
 // -------------------------------------------------------------------
 
 Msg async(Time bl, Time dl, Object *to, Method m, int arg); 
+Msg periodic(Time bl, Time per, Time dl, Object *to, Method m, int arg);
+Msg try_async(Time bl, Time dl, Object *to, Method m, int arg);
+Msg async_data(Time bl, Time dl, Object *to, Method m, const void *data,
+               int size, int mayFail);
 int sync(Object *to, Method m, int arg);
-void install(Object *obj, Method m, enum Vector index);
+void install(Object *obj, Method m, enum Vector index, int prio);
 int tinytimber(Object *obj, Method startup, int arg);
+#ifdef __USE_LOCK_STATS
+void lock_stats(Object *obj, LockStats *s);
+void lock_stats_reset(Object *obj);
+#endif
+
+#ifdef __TINYTIMBER_POSIX
+void posix_interrupt(enum Vector i);
+#endif
+
+#ifdef __TINYTIMBER_SIM
+LongTime sim_time(void);
+void sim_start(LongTime t);
+// Scripted input, provided by the host: sim_next_input stores the time of
+// the next input event in *at and returns 1, or returns 0 if there is none,
+// and sim_input delivers that event.
+int sim_next_input(Time *at);
+void sim_input(void);
+#endif
 
 #endif
@@ -10,8 +10,20 @@
  *  - 'w': Increase the volume of the tone.
  *  - 's': Decrease the volume of the tone.
  *  - 'm': Toggle mute on/off for the tone.
+ *  - 'f': Switch to the next waveform (square, sine, triangle, saw).
+ *  - 'b': Toggle a bass voice two octaves below the melody.
  *  Write numbers and press 't': Enter a new tempo (beats per minute).
  *  Write numbers and press 'k': Enter a new key offset.
+ *  - 'p': Print message pool statistics.
+ *  - 'u': Print thread stack usage.
+ *  - 'h': Print per-method timing histograms (with __USE_METHOD_STATS).
+ *  - 'l': Print per-object lock contention (with __USE_LOCK_STATS).
+ *  - 'i': Print wakeups and idle time since the last 'i' (with
+ *         __USE_IDLE_STATS).
+ *  - 'q': Print interrupt counts and longest handler runs (with
+ *         __USE_IRQ_STATS).
+ *  - 'c': Print context switches and their mean and longest cost since
+ *         the last 'c' (with __USE_SWITCH_STATS).
  *
  * Note: The program uses a DAC (Digital-to-Analog Converter) to generate the
  * tone output. Make sure the DAC is properly connected to the device running
@@ -22,6 +34,7 @@
  */
 
 #include "TinyTimber.h"
+#include "audioEngine.h"
 #include "canTinyTimber.h"
 #include "ledHandler.h"
 #include "sciTinyTimber.h"
@@ -41,11 +54,12 @@
 void start_app(App *self, int unused);
 
 void reader(App *self, int);
-void receiver(App *self, int);
+void receiver(App *self, CANMsg *msg);
 
 App app = initApp();
 MusicPlayer music_player = initMusicPlayer();
 ToneGenerator tone_generator = initToneGenerator();
+AudioEngine audio = initAudioEngine(AUDIO_SINK);
 
 ButtonHandler button_handler = initButtonHandler();
 LedHandler led_handler = initLedHandler();
@@ -59,6 +73,7 @@ int main() {
   INSTALL(&sci0, sci_interrupt, SCI_IRQ0);
   INSTALL(&can0, can_interrupt, CAN_IRQ0);
   INSTALL(&sio, sio_interrupt, SIO_IRQ0);
+  INSTALL(&audio, audio_interrupt, AUDIO_IRQ0);
 
   TINYTIMBER(&app, start_app, 0);
 
@@ -81,6 +96,7 @@ void start_app(App *self, int unused) {
   CAN_INIT(&can0);
   SCI_INIT(&sci0);
   SIO_INIT(&sio);
+  AUDIO_INIT(&audio);
 
   print_raw("Welcome to the Music Player!\n");
   print_raw("/-----------------------------------\\\n");
@@ -90,21 +106,196 @@ void start_app(App *self, int unused) {
   print_raw("Press 'w' to increase volume.\n");
   print_raw("Press 's' to decrease volume.\n");
   print_raw("Press 'm' to toggle mute.\n");
+  print_raw("Press 'f' to change the waveform.\n");
+  print_raw("Press 'b' to toggle the bass.\n");
   print_raw("Press 't' to enter tempo.\n");
   print_raw("Press 'k' to enter key.\n");
   print_raw("Press 'v' to play music.\n");
   print_raw("Press 'x' to stop music.\n");
+  print_raw("Press 'p' to print message pool statistics.\n");
+  print_raw("Press 'u' to print thread stack usage.\n");
+#ifdef __USE_METHOD_STATS
+  print_raw("Press 'h' to print method timing statistics.\n");
+#endif
+#ifdef __USE_LOCK_STATS
+  print_raw("Press 'l' to print lock contention statistics.\n");
+#endif
+#ifdef __USE_IDLE_STATS
+  print_raw("Press 'i' to print idle statistics.\n");
+#endif
+#ifdef __USE_IRQ_STATS
+  print_raw("Press 'q' to print interrupt statistics.\n");
+#endif
+#ifdef __USE_SWITCH_STATS
+  print_raw("Press 'c' to print context switch statistics.\n");
+#endif
 }
 
-void receiver(App *self, int unused) {
-  if (self->state == DISCONNECTED)
+void print_pool_stats(App *self) {
+  print("Messages in use: %d", POOL_USED());
+  print(" of %d", NMSGS);
+  print(" (high water %d)\n", POOL_HIGHWATER());
+  print("Dropped: %d", POOL_DROPPED());
+  print(" (sci %d,", sci0.dropped);
+  print(" can %d)\n", can0.dropped);
+  print("Audio refills late: %d,", audio.late);
+  print(" notes stolen %d\n", audio.stolen);
+  print("Pending: app %d,", PENDING(self));
+  print(" player %d,", PENDING(&music_player));
+  print(" tone %d,", PENDING(&tone_generator));
+  print(" led %d,", PENDING(&led_handler));
+  print(" button %d\n", PENDING(&button_handler));
+}
+
+void print_stack_usage(App *self) {
+  for (int i = 0; i < THREADS(); i++) {
+    print("Thread %d stack:", i);
+    print(" %d", STACK_HIGHWATER(i));
+    print(" of %d bytes used\n", STACK_SIZE(i));
+  }
+}
+
+#ifdef __USE_METHOD_STATS
+static const struct {
+  Method method;
+  char *name;
+} method_names[] = {
+#ifdef __TINYTIMBER_POSIX
+    {(Method)audio_tick, "audio_tick"}, // on the board a handler, not a message
+#endif
+    {(Method)led_tick, "led_tick"},
+    {(Method)player_tick, "player_tick"},
+    {(Method)reader, "reader"},
+    {(Method)receiver, "receiver"},
+    {(Method)sio_reader, "sio_reader"},
+    {(Method)button_was_held, "button_was_held"},
+};
+
+static char *method_name(Method method) {
+  for (int i = 0; i < sizeof(method_names) / sizeof(method_names[0]); i++)
+    if (method_names[i].method == method)
+      return method_names[i].name;
+
+  return "?";
+}
+
+/**
+ * Prints the non-empty buckets of a log2 histogram as "bucket:count", where
+ * bucket b holds values below 2^b timer ticks (10 us each).
+ */
+static void print_histogram(char *label, unsigned *histogram) {
+  print_raw(label);
+
+  for (int b = 0; b < __STATS_BUCKETS; b++) {
+    if (!histogram[b])
+      continue;
+
+    print(" %d:", b);
+    print("%d", histogram[b]);
+  }
+
+  print_raw("\n");
+}
+
+void print_method_stats(App *self) {
+  MethodStats stats;
+
+  for (int i = 0; i < __METHOD_STATS_SLOTS; i++) {
+    if (!METHOD_STATS(i, &stats))
+      continue;
+
+    print_raw(method_name(stats.method));
+    print(": runs %d,", stats.runs);
+    print(" deadline misses %d\n", stats.misses);
+    print_histogram("  latency:  ", stats.latency);
+    print_histogram("  execution:", stats.execution);
+  }
+}
+#endif
+
+#ifdef __USE_LOCK_STATS
+static void print_lock(char *name, Object *object) {
+  LockStats stats;
+
+  LOCK_STATS(object, &stats);
+
+  print_raw(name);
+  print(": syncs %d,", stats.syncs);
+  print(" contended %d,", stats.contended);
+  print(" blocked %d ticks,", stats.blocked);
+  print(" longest chain %d,", stats.chain);
+  print(" deadlocks %d\n", stats.deadlocks);
+}
+
+void print_lock_stats(App *self) {
+  print_lock("app", &self->super);
+  print_lock("player", &music_player.super);
+  print_lock("tone", &tone_generator.super);
+  print_lock("led", &led_handler.super);
+  print_lock("button", &button_handler.super);
+  print_lock("sci", &sci0.super);
+  print_lock("can", &can0.super);
+  print_lock("sio", &sio.super);
+  print_lock("audio", &audio.super);
+}
+#endif
+
+#ifdef __USE_IDLE_STATS
+void print_idle_stats(App *self) {
+  IdleStats stats;
+
+  IDLE_STATS(&stats);
+  IDLE_STATS_RESET();
+
+  if (stats.elapsed <= 0)
     return;
 
-  CANMsg msg;
+  print("Over %d ms:", stats.elapsed / MSEC(1));
+  print(" %d wakeups per second,",
+        (int)(stats.wakeups * (long long)SEC(1) / stats.elapsed));
+  print(" %d%% idle\n", (int)(stats.idle * 100LL / stats.elapsed));
+}
+#endif
+
+#ifdef __USE_IRQ_STATS
+static void print_irq(char *name, enum Vector i) {
+  IrqStats stats;
+
+  if (!IRQ_STATS(i, &stats))
+    return;
+
+  print_raw(name);
+  print(": entries %d,", stats.entries);
+  print(" longest %d ns\n", stats.worst);
+}
+
+void print_irq_stats(App *self) {
+  print_irq("timer", IRQ_TIM5);
+  print_irq("sci", SCI_IRQ0);
+  print_irq("can", CAN_IRQ0);
+  print_irq("sio", SIO_IRQ0);
+  print_irq("audio", AUDIO_IRQ0);
+}
+#endif
+
+#ifdef __USE_SWITCH_STATS
+void print_switch_stats(App *self) {
+  SwitchStats stats;
 
-  CAN_RECEIVE(&can0, &msg);
+  SWITCH_STATS(&stats);
+  SWITCH_STATS_RESET();
 
-  can_action(&msg, self->state);
+  print("Switches %d,", stats.switches);
+  print(" mean %d ns,", stats.mean);
+  print(" longest %d ns\n", stats.worst);
+}
+#endif
+
+void receiver(App *self, CANMsg *msg) {
+  if (self->state == DISCONNECTED)
+    return;
+
+  can_action(msg, self->state);
 }
 
 /**
@@ -195,6 +386,32 @@ void reader(App *self, int c) {
         print_raw("Music is already playing.\n");
     }
 
+    break;
+  case 'f': {
+    char waveform = '0' + (tone_generator.waveform + 1) % N_WAVES;
+
+    send_can_action(&can0, CHANGE_WAVEFORM, &waveform, 1);
+
+    if (self->state == CONDUCTOR) {
+      SYNC(&music_player, change_waveform, waveform - '0');
+
+      print_raw("Waveform: ");
+      print_raw((char *)WAVE_NAMES[tone_generator.waveform]);
+      print_raw("\n");
+    }
+
+    break;
+  }
+  case 'b':
+    send_can_action(&can0, TOGGLE_BASS, "0", 1);
+
+    if (self->state == CONDUCTOR) {
+      if (SYNC(&music_player, toggle_music_bass, 0))
+        print_raw("Bass is on.\n");
+      else
+        print_raw("Bass is off.\n");
+    }
+
     break;
   case 'x':
     send_can_action(&can0, STOP_MUSIC, "0", 1);
@@ -207,6 +424,44 @@ void reader(App *self, int c) {
     }
 
     break;
+  case 'p':
+    print_pool_stats(self);
+
+    break;
+  case 'u':
+    print_stack_usage(self);
+
+    break;
+#ifdef __USE_METHOD_STATS
+  case 'h':
+    print_method_stats(self);
+
+    break;
+#endif
+#ifdef __USE_IDLE_STATS
+  case 'i':
+    print_idle_stats(self);
+
+    break;
+#endif
+#ifdef __USE_IRQ_STATS
+  case 'q':
+    print_irq_stats(self);
+
+    break;
+#endif
+#ifdef __USE_SWITCH_STATS
+  case 'c':
+    print_switch_stats(self);
+
+    break;
+#endif
+#ifdef __USE_LOCK_STATS
+  case 'l':
+    print_lock_stats(self);
+
+    break;
+#endif
   case 'e':
     self->state = CONDUCTOR;
 
@@ -0,0 +1,275 @@
+#include "audioEngine.h"
+
+const char *const WAVE_NAMES[N_WAVES] = {"square", "sine", "triangle", "saw"};
+
+// The first quarter of a sine cycle in Q15, the rest follows by symmetry.
+static const int16_t QUARTER_SINE[WAVE_SIZE / 4 + 1] = {
+    0,     804,   1608,  2410,  3212,  4011,  4808,  5602,  6393,  7179,
+    7962,  8739,  9512,  10278, 11039, 11793, 12539, 13279, 14010, 14732,
+    15446, 16151, 16846, 17530, 18204, 18868, 19519, 20159, 20787, 21403,
+    22005, 22594, 23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+    27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956, 30273, 30571,
+    30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521,
+    32609, 32678, 32728, 32757, 32767};
+
+// One cycle of each Waveform in Q15, built by audio_init.
+static int16_t wavetables[N_WAVES][WAVE_SIZE];
+
+static void build_wavetables(void) {
+  const int quarter = WAVE_SIZE / 4, half = WAVE_SIZE / 2;
+
+  for (int i = 0; i < WAVE_SIZE; i++) {
+    int q = i % quarter, sine;
+
+    switch (i / quarter) {
+    case 0:
+      sine = QUARTER_SINE[q];
+      break;
+    case 1:
+      sine = QUARTER_SINE[quarter - q];
+      break;
+    case 2:
+      sine = -QUARTER_SINE[q];
+      break;
+    default:
+      sine = -QUARTER_SINE[quarter - q];
+      break;
+    }
+
+    wavetables[WAVE_SQUARE][i] = i < half ? 32767 : -32767;
+    wavetables[WAVE_SINE][i] = sine;
+    wavetables[WAVE_TRIANGLE][i] = i < half ? -32767 + i * 65534 / half
+                                            : 32767 - (i - half) * 65534 / half;
+    wavetables[WAVE_SAW][i] = -32767 + i * 65534 / (WAVE_SIZE - 1);
+  }
+}
+
+/**
+ * The sample of a wavetable at phase, at half of full scale. The two
+ * neighbouring entries are packed into one word and weighted by the phase
+ * bits below the index with a single __SMLAD.
+ */
+static inline int32_t voice_sample(const int16_t *table, uint32_t phase) {
+  int i = phase >> (32 - WAVE_BITS);
+  uint32_t frac = phase >> (32 - WAVE_BITS - 15) & 0x7FFF;
+  uint32_t pair = (uint16_t)table[i] |
+                  (uint32_t)(uint16_t)table[(i + 1) & (WAVE_SIZE - 1)] << 16;
+
+  return (int32_t)__SMLAD(pair, (0x7FFF - frac) | frac << 16, 0) >> 16;
+}
+
+// Envelope change per block for a segment taking ms from 0 to full scale.
+#define ENV_STEP(ms) (32767 * AUDIO_HALF_USEC / ((ms) * 1000))
+
+/**
+ * Advances the envelope of a voice by one block.
+ *
+ * @return The envelope at the end of the block.
+ */
+static int32_t envelope(Voice *voice) {
+  int32_t env = voice->env;
+
+  switch (voice->stage) {
+  case ENV_ATTACK:
+    if ((env += ENV_STEP(ENV_ATTACK_MS)) >= 32767) {
+      env = 32767;
+      voice->stage = ENV_DECAY;
+    }
+    break;
+  case ENV_DECAY:
+    if ((env -= ENV_STEP(ENV_DECAY_MS)) <= ENV_SUSTAIN_LEVEL) {
+      env = ENV_SUSTAIN_LEVEL;
+      voice->stage = ENV_SUSTAIN;
+    }
+    break;
+  case ENV_RELEASE:
+    if ((env -= ENV_STEP(ENV_RELEASE_MS)) <= 0) {
+      env = 0;
+      voice->stage = ENV_OFF; // after this block
+    }
+    break;
+  }
+
+  return env;
+}
+
+// One step of a xorshift generator, the noise for the dither.
+static uint32_t noise(AudioEngine *self) {
+  uint32_t x = self->noise;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  return self->noise = x;
+}
+
+/**
+ * Renders the next AUDIO_HALF samples into out. The voices are mixed two
+ * samples at a time as packed Q15 pairs with the saturating __QADD16, and
+ * the mix is scaled by the gain to 12-bit samples around SINK_MIDSCALE.
+ * Both the envelopes and the gain move in straight lines across the block.
+ * While any voice sounds, TPDF dither of +-1 LSB is added before the
+ * samples are rounded to 12 bits (with AUDIO_DITHER).
+ *
+ * @param self A pointer to the AudioEngine.
+ * @param out The half of the buffer to fill.
+ */
+static void render(AudioEngine *self, uint16_t *out) {
+  const int16_t *table = wavetables[self->wave];
+  uint32_t mix[AUDIO_HALF / 2] = {0};
+  int32_t gain = self->ramp, gain_step = (self->gain - gain) / AUDIO_HALF;
+  int sounding = 0;
+
+  for (int v = 0; v < AUDIO_VOICES; v++) {
+    Voice *voice = &self->voices[v];
+    uint32_t phase = voice->phase, increment = voice->increment;
+    int32_t env = voice->env, env_end, env_step;
+
+    if (voice->stage == ENV_OFF)
+      continue;
+
+    sounding = 1;
+    env_end = envelope(voice);
+    env_step = (env_end - env) / AUDIO_HALF;
+
+    for (int i = 0; i < AUDIO_HALF / 2; i++) {
+      uint32_t pair = (uint16_t)(voice_sample(table, phase) * env >> 15);
+
+      phase += increment;
+      env += env_step;
+      pair |= (uint32_t)(uint16_t)(voice_sample(table, phase) * env >> 15)
+              << 16;
+      phase += increment;
+      env += env_step;
+
+      mix[i] = __QADD16(mix[i], pair);
+    }
+
+    voice->phase = phase;
+    voice->env = env_end;
+  }
+
+  self->ramp = self->gain;
+
+  // The scaled samples keep 4 bits below the 12-bit LSB for the dither and
+  // the rounding.
+  for (int i = 0; i < AUDIO_HALF; i++) {
+    int32_t x = (int16_t)(mix[i / 2] >> (i & 1) * 16) * gain >> 15;
+    int32_t sample;
+
+    gain += gain_step;
+
+    x += (SINK_MIDSCALE << 4) + 8; // and half an LSB, to round
+    if (AUDIO_DITHER && sounding) {
+      uint32_t r = noise(self);
+
+      x += (int32_t)(r & 15) + (int32_t)(r >> 4 & 15) - 15;
+    }
+
+    sample = x >> 4;
+    out[i] = sample < 0 ? 0 : sample > SINK_MAX ? SINK_MAX : sample;
+  }
+}
+
+/**
+ * Starts a note at the given phase increment per sample on a free voice, or
+ * on the voice of the oldest note if all are taken. The attack starts from
+ * wherever the envelope of the voice is, so a stolen voice does not click.
+ *
+ * @return The handle of the note, for audio_note_off.
+ */
+int audio_note_on(AudioEngine *self, int increment) {
+  Voice *voice = &self->voices[0];
+
+  for (int v = 0; v < AUDIO_VOICES; v++) {
+    if (self->voices[v].stage == ENV_OFF) {
+      voice = &self->voices[v];
+      break;
+    }
+    if (self->voices[v].note < voice->note)
+      voice = &self->voices[v];
+  }
+
+  if (voice->stage != ENV_OFF)
+    self->stolen++;
+
+  voice->increment = increment;
+  voice->note = ++self->notes;
+  voice->stage = ENV_ATTACK;
+
+  return voice->note;
+}
+
+/**
+ * Releases a note, unless its voice has since been taken by another one.
+ */
+int audio_note_off(AudioEngine *self, int note) {
+  for (int v = 0; v < AUDIO_VOICES; v++)
+    if (self->voices[v].stage != ENV_OFF && self->voices[v].note == note)
+      self->voices[v].stage = ENV_RELEASE;
+
+  return 0;
+}
+
+/**
+ * Sets the gain of the mix in Q15, full scale at 32767.
+ */
+int audio_set_gain(AudioEngine *self, int gain) {
+  self->gain = gain;
+
+  return 0;
+}
+
+int audio_set_wave(AudioEngine *self, int wave) {
+  if (wave < 0 || wave >= N_WAVES)
+    return -1;
+
+  self->wave = wave;
+
+  return 0;
+}
+
+static void refill(AudioEngine *self, int half) {
+  uint16_t *out = self->buf + half * AUDIO_HALF;
+
+  render(self, out);
+  if (self->sink->filled)
+    self->sink->filled(out, AUDIO_HALF);
+}
+
+#ifdef __TINYTIMBER_POSIX
+// Plays the part of the DMA interrupts, one half-buffer per period.
+void audio_tick(AudioEngine *self, int unused) {
+  refill(self, self->next);
+  self->next ^= 1;
+}
+#endif
+
+void audio_init(AudioEngine *self, int unused) {
+  build_wavetables();
+
+  render(self, self->buf);
+  render(self, self->buf + AUDIO_HALF);
+  self->sink->start(self->buf, 2 * AUDIO_HALF);
+
+#ifdef __TINYTIMBER_POSIX
+  PERIODIC(0, USEC(AUDIO_HALF_USEC), USEC(AUDIO_HALF_USEC), self, audio_tick,
+           0);
+#endif
+}
+
+/**
+ * Refills the halves of the buffer that the sink has finished playing.
+ */
+void audio_interrupt(AudioEngine *self, int unused) {
+  int played = self->sink->played();
+
+  if (played == 3)
+    self->late++;
+
+  if (played & 1)
+    refill(self, 0);
+  if (played & 2)
+    refill(self, 1);
+}
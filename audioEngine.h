@@ -0,0 +1,113 @@
+#ifndef AUDIO_ENGINE_H
+#define AUDIO_ENGINE_H
+
+#include "TinyTimber.h"
+#include "sampleSink.h"
+#include <stdint.h>
+
+#define AUDIO_RATE 20000 // samples per second
+#define AUDIO_SAMPLE_USEC (1000000 / AUDIO_RATE)
+#define AUDIO_HALF 64 // samples per half-buffer
+#define AUDIO_HALF_USEC (AUDIO_HALF * AUDIO_SAMPLE_USEC) // time to refill one
+
+#define AUDIO_VOICES 4 // notes that can sound at once
+
+#ifndef AUDIO_DITHER
+#define AUDIO_DITHER 1 // TPDF dither before rounding to 12 bits
+#endif
+
+// The envelope of every note, times from silence to full scale and back.
+// The release must fit in the GAP_SILENCE between two notes.
+#define ENV_ATTACK_MS 5
+#define ENV_DECAY_MS 50
+#define ENV_SUSTAIN_LEVEL 24576 // Q15
+#define ENV_RELEASE_MS 60
+
+#define WAVE_BITS 8 // top bits of the phase that index the wavetable
+#define WAVE_SIZE (1 << WAVE_BITS)
+
+typedef enum {
+  WAVE_SQUARE,
+  WAVE_SINE,
+  WAVE_TRIANGLE,
+  WAVE_SAW,
+  N_WAVES,
+} Waveform;
+
+extern const char *const WAVE_NAMES[N_WAVES];
+
+//
+// Audio output: the sink plays buf in a circle at AUDIO_RATE, and each half
+// is refilled once it has been played. On the board the sink is DAC channel
+// 2 fed by DMA, and its half-transfer and transfer-complete interrupts drive
+// the refills, so the output runs without any kernel messages. The host
+// build has no DMA and refills from a periodic message instead.
+//
+// Each of the AUDIO_VOICES voices is a phase accumulator: each sample adds
+// increment to the 32-bit phase, which wraps once per cycle, and the top
+// WAVE_BITS bits index the wavetable of the current waveform, interpolated
+// by the bits below. An increment of f * 2^32 / AUDIO_RATE plays frequency f
+// to within AUDIO_RATE / 2^32 Hz. The voices are summed with saturation, each
+// at half of full scale, so two never clip.
+//
+// Each voice is shaped by an attack/decay/sustain/release envelope. It is
+// advanced once per half-buffer, and the samples in between are scaled by a
+// straight line from its value at the start of the block to that at the end.
+// Stopping a note starts its release, and the voice is free once the release
+// has reached silence.
+//
+typedef enum {
+  ENV_OFF, // free
+  ENV_ATTACK,
+  ENV_DECAY,
+  ENV_SUSTAIN,
+  ENV_RELEASE,
+} EnvelopeStage;
+
+typedef struct {
+  uint32_t phase;
+  uint32_t increment; // phase per sample
+  int note;           // handle returned by audio_note_on
+  int stage;          // EnvelopeStage
+  int32_t env;        // envelope at the start of the next block, Q15
+} Voice;
+
+typedef struct {
+  Object super;
+  Voice voices[AUDIO_VOICES];
+  int notes;  // notes started, the handle of the latest
+  int wave;   // Waveform
+  int gain;   // of the mix, Q15
+  int ramp;   // gain reached by the last block, ramped towards gain
+  int stolen; // notes cut short to make room
+  int late;   // interrupts that found both halves played
+  int next;   // host build: half to refill next
+  uint32_t noise;
+  const SampleSink *sink;
+  uint16_t buf[2 * AUDIO_HALF]; // 12-bit samples
+} AudioEngine;
+
+#define initAudioEngine(sink)                                                  \
+  {                                                                            \
+    initObject(), {{0}}, 0, WAVE_SQUARE, 0, 0, 0, 0, 0, 0x2545F491, sink, {0}  \
+  }
+
+#define AUDIO_IRQ0 IRQ_DMA1_Stream6
+
+void audio_init(AudioEngine *self, int unused);
+int audio_note_on(AudioEngine *self, int increment);
+int audio_note_off(AudioEngine *self, int note);
+int audio_set_gain(AudioEngine *self, int gain);
+int audio_set_wave(AudioEngine *self, int wave);
+
+#define AUDIO_INIT(audio) SYNC(audio, audio_init, 0)
+
+void audio_interrupt(AudioEngine *self, int unused);
+
+#ifdef __TINYTIMBER_POSIX
+void audio_tick(AudioEngine *self, int unused); // the refills, as a message
+#endif
+
+extern AudioEngine audio;
+
+#endif
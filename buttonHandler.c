@@ -12,8 +12,8 @@ Timer last_button_press = initTimer();
 Timer last_release_press = initTimer();
 Timer held_timer = initTimer();
 
-Time get_time_since_last_button_press() { return T_SAMPLE(&last_button_press); }
-Time get_time_since_last_release_press() {
+LongTime get_time_since_last_button_press() { return T_SAMPLE(&last_button_press); }
+LongTime get_time_since_last_release_press() {
   return T_SAMPLE(&last_release_press);
 }
 
@@ -32,7 +32,7 @@ typedef struct {
   Msg hold_call;
 } ButtonHandler;
 
-Time get_time_since_last_button_press();
+LongTime get_time_since_last_button_press();
 
 void sio_reader(ButtonHandler *self, int unused);
 
@@ -1,5 +1,6 @@
 #include "canHandler.h"
 #include "application.h"
+#include "audioEngine.h"
 #include "canHandler.h"
 #include "canTinyTimber.h"
 #include "musicPlayer.h"
@@ -90,6 +91,28 @@ bool can_action(CANMsg *msg, MUSIC_PLAYER_STATE user_state) {
 
     return true;
   case TOGGLE_IS_PLAYING:
+    break;
+  case TOGGLE_BASS:
+    if (SYNC(&music_player, toggle_music_bass, 0)) {
+      print_raw("Bass is on.\n");
+    } else {
+      print_raw("Bass is off.\n");
+    }
+
+    return true;
+  case CHANGE_WAVEFORM:
+    if (data_length > 0) {
+      if (SYNC(&music_player, change_waveform, data)) {
+        print_raw("Waveform: ");
+        print_raw((char *)WAVE_NAMES[data]);
+        print_raw("\n");
+      } else {
+        print_raw("Waveform out of range\n");
+      }
+
+      return true;
+    }
+
     break;
   default:
     break;
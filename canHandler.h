@@ -1,12 +1,14 @@
 #ifndef CAN_HANDLER_H
 #define CAN_HANDLER_H
 
-#define NODE_ID 0
-
 #include "TinyTimber.h"
 #include "canTinyTimber.h"
 #include <stdbool.h>
 
+#ifndef NODE_ID
+#define NODE_ID 0 // CAN node ID of this board, 0-15
+#endif
+
 typedef enum {
   DISCONNECTED,
   CONDUCTOR,
@@ -22,6 +24,8 @@ typedef enum {
   CHANGE_KEY,
   TOGGLE_MUTE,
   TOGGLE_IS_PLAYING,
+  CHANGE_WAVEFORM,
+  TOGGLE_BASS,
 } CAN_ACTION;
 
 // CAN
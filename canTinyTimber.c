@@ -55,14 +55,13 @@ void can_init(Can *self, int unused) {
 //	else
 //		DUMP("CAN #2 successful!\n\r");
 
-	NVIC_SetPriority( CAN1_RX0_IRQn, __IRQ_PRIORITY);
-	NVIC_EnableIRQ( CAN1_RX0_IRQn);
 	CAN_ITConfig(CAN1, CAN_IT_FMP0, ENABLE);
 }
 
 //
-// When a message is received on the can bus, store it in a software
-// buffer, notify the listener and clear the receive interrupt.
+// When a message is received on the can bus, send it to the listener, or
+// without one store it in a software buffer for can_receive, and clear
+// the receive interrupt.
 //
 void can_interrupt(Can *self, int unused) {
     uchar index;
@@ -73,26 +72,31 @@ void can_interrupt(Can *self, int unused) {
 	else
 		DUMP("\n\rStrange: Not a CAN #1 FIFO0 IRQ!\n\r");
 	
-	if (self->count < CAN_BUFSIZE) {
-		CanRxMsg RxMessage;
+	CanRxMsg RxMessage;
+	CANMsg msg;
 
+	if (self->obj || self->count < CAN_BUFSIZE) {
 		CAN_Receive(self->port, CAN_FIFO0, &RxMessage);
-		
-        self->iBuff[self->head].msgId = (RxMessage.StdId >> 4) & 0x7F;
-        self->iBuff[self->head].nodeId = RxMessage.StdId & 0x0F;
 
-        self->iBuff[self->head].length = (RxMessage.DLC & 0x0F);
+        msg.msgId = (RxMessage.StdId >> 4) & 0x7F;
+        msg.nodeId = RxMessage.StdId & 0x0F;
 
-        for (index = 0; index < self->iBuff[self->head].length; index++) {
+        msg.length = (RxMessage.DLC & 0x0F);
+
+        for (index = 0; index < msg.length; index++) {
             // Get received data
-            self->iBuff[self->head].buff[index] = RxMessage.Data[index];
+            msg.buff[index] = RxMessage.Data[index];
         }
-    
-        if (self->obj) {
-			ASYNC(self->obj, self->meth, (self->iBuff[self->head].msgId<<4) + self->iBuff[self->head].nodeId);
+    }
+
+    if (self->obj) {
+		// hand the frame itself to the listener, no buffering or CAN_RECEIVE
+		if (!TRY_ASYNC_DATA(self->obj, self->meth, &msg))
+			self->dropped++;
+		else
 			doIRQSchedule = 1;
-		}
-        
+	} else if (self->count < CAN_BUFSIZE) {
+        self->iBuff[self->head] = msg;
         self->head = (self->head + 1) % CAN_BUFSIZE;
         self->count++;
     } else {
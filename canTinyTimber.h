@@ -18,16 +18,17 @@ typedef struct {
 typedef struct {
   Object super;
   CAN_TypeDef *port;
-  Object *obj;
+  Object *obj;  // listener, sent every frame received as meth(obj, CANMsg *)
   Method meth;
   int head;
   int tail;
   int count;
+  int dropped; // received frames lost to an empty message pool
   CANMsg iBuff[CAN_BUFSIZE];
 } Can;
 
 #define initCan(port, obj, meth)                                               \
-  { initObject(), port, (Object *)obj, (Method)meth, 0, 0, 0 }
+  { initObject(), port, (Object *)obj, (Method)meth, 0, 0, 0, 0 }
 
 #define CAN_PORT0 (CAN_TypeDef *)(CAN1)
 #define CAN_IRQ0 IRQ_CAN1
@@ -38,7 +39,7 @@ int can_send(Can *obj, CANMsg *msg);
 
 #define CAN_INIT(can) SYNC(can, can_init, 0)
 #define CAN_SEND(can, msgptr) SYNC(can, can_send, msgptr)
-#define CAN_RECEIVE(can, msgptr) SYNC(can, can_receive, msgptr)
+#define CAN_RECEIVE(can, msgptr) SYNC(can, can_receive, msgptr) // without obj
 
 void can_interrupt(Can *self, int unused);
 
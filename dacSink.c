@@ -0,0 +1,65 @@
+#include "audioEngine.h"
+#include "sampleSink.h"
+#include "stm32f4xx_dac.h"
+#include "stm32f4xx_rcc.h"
+#include "stm32f4xx_tim.h"
+
+#define DAC_TIMER_CLOCK 84000000 // TIM6 on APB1, as TIM5 in TinyTimber.c
+
+/**
+ * Plays buf in a circle: TIM6 update events at AUDIO_RATE trigger DAC
+ * channel 2, and DMA1 stream 6 feeds it one 12-bit sample per conversion,
+ * interrupting (AUDIO_IRQ0) when it is half way through buf and at the end.
+ */
+static void dac_start(uint16_t *buf, int n) {
+  TIM_TimeBaseInitTypeDef TIM_TimeBaseInitStructure;
+  DAC_InitTypeDef DAC_InitStructure;
+
+  RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM6, ENABLE);
+  RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
+
+  TIM_DeInit(TIM6);
+  TIM_TimeBaseStructInit(&TIM_TimeBaseInitStructure);
+  TIM_TimeBaseInitStructure.TIM_Period = DAC_TIMER_CLOCK / AUDIO_RATE - 1;
+  TIM_TimeBaseInit(TIM6, &TIM_TimeBaseInitStructure);
+  TIM_SelectOutputTrigger(TIM6, TIM_TRGOSource_Update);
+
+  // PA.5 is set up by startup.c.
+  DAC_Cmd(DAC_Channel_2, DISABLE);
+  DAC_StructInit(&DAC_InitStructure);
+  DAC_InitStructure.DAC_Trigger = DAC_Trigger_T6_TRGO;
+  DAC_InitStructure.DAC_WaveGeneration = DAC_WaveGeneration_None;
+  DAC_InitStructure.DAC_OutputBuffer = DAC_OutputBuffer_Enable;
+  DAC_Init(DAC_Channel_2, &DAC_InitStructure);
+  DAC_SetChannel2Data(DAC_Align_12b_R, buf[0]);
+  DAC_Cmd(DAC_Channel_2, ENABLE);
+  DAC_DMACmd(DAC_Channel_2, ENABLE);
+
+  // Channel 7 of the stream is the DAC2 request: halfwords from buf to
+  // DHR12R2.
+  DMA1_Stream6->CR = 0;
+  while (DMA1_Stream6->CR & DMA_SxCR_EN)
+    ;
+  DMA1->HIFCR = DMA_HIFCR_CTCIF6 | DMA_HIFCR_CHTIF6 | DMA_HIFCR_CTEIF6 |
+                DMA_HIFCR_CDMEIF6 | DMA_HIFCR_CFEIF6;
+  DMA1_Stream6->PAR = (uint32_t)&DAC->DHR12R2;
+  DMA1_Stream6->M0AR = (uint32_t)buf;
+  DMA1_Stream6->NDTR = n;
+  DMA1_Stream6->FCR = 0; // direct mode
+  DMA1_Stream6->CR = DMA_SxCR_CHSEL | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 |
+                     DMA_SxCR_MINC | DMA_SxCR_CIRC | DMA_SxCR_DIR_0 |
+                     DMA_SxCR_HTIE | DMA_SxCR_TCIE;
+  DMA1_Stream6->CR |= DMA_SxCR_EN;
+
+  TIM_Cmd(TIM6, ENABLE);
+}
+
+static int dac_played(void) {
+  uint32_t status = DMA1->HISR & (DMA_HISR_HTIF6 | DMA_HISR_TCIF6);
+
+  DMA1->HIFCR = status; // the clear bits sit where the flags do
+
+  return (status & DMA_HISR_HTIF6 ? 1 : 0) | (status & DMA_HISR_TCIF6 ? 2 : 0);
+}
+
+const SampleSink dac_sink = {dac_start, dac_played, NULL};
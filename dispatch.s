@@ -11,6 +11,7 @@
 	.global	DUMPH
 	.global current
 	.global upcoming
+	.weak	switchStatsRecord @ defined with __USE_SWITCH_STATS
  @	EXPORTS
 	.global vect_SVCall
 	.global vect_PendSV
@@ -33,8 +34,15 @@ vect_PendSV:
 	ldr r1, =L01
 
 vect_PendSV1:
+	ldr r3, =switchStatsRecord
+	cbz r3, L000s
+	ldr r3, =0xE0001004 @ DWT->CYCCNT
+	ldr r12, [r3] @ start of the switch, kept in r12 to the end
+L000s:
 	mrs r0, msp
-	vstmdb r0!, {s16-s31} @ save floating point registers
+	tst lr, #0x10 @ EXC_RETURN bit 4 clear: thread has FP context
+	it eq
+	vstmdbeq r0!, {s16-s31} @ save floating point registers
 	mov r2, lr
 	mrs r3, basepri
 	stmdb r0!, {r2-r11} @ save LR, BASEPRI and R4 to R11
@@ -102,8 +110,18 @@ L000b:
 	ldmia r0!, {r2-r11} @ load LR, BASEPRI and R4 to R11
 	msr basepri, r3
 	mov lr, r2
-	vldmia r0!, {s16-s31} @ load floating point registers
+	tst lr, #0x10 @ EXC_RETURN bit 4 clear: thread has FP context
+	it eq
+	vldmiaeq r0!, {s16-s31} @ load floating point registers
 	msr msp, r0
+
+	ldr r3, =switchStatsRecord
+	cbz r3, L000e
+	push {r0, lr} @ r0 to keep the stack 8-byte aligned
+	mov r0, r12
+	blx r3 @ switchStatsRecord(start), which keeps R4 to R11
+	pop {r0, lr}
+L000e:
 	bx lr
 
 	.size  vect_PendSV, .-vect_PendSV
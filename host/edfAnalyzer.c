@@ -0,0 +1,454 @@
+/*
+ * Offline EDF schedulability check of the music player's task set.
+ *
+ * The tasks and their timing come from the code: audio_interrupt, the DMA
+ * interrupt that refills half of the DAC buffer every AUDIO_HALF_USEC and
+ * must be done before the DMA is back at that half; led_tick, released
+ * twice per beat with a USEC(100) deadline; and player_tick, which per beat
+ * mutes the note at beat - GAP_SILENCE (deadline one beat) and starts the
+ * next one GAP_SILENCE later (deadline GAP_SILENCE). Each player_tick is
+ * analysed as a sporadic task released once per shortest beat of the
+ * melody. The periods are rounded to kernel ticks as USEC and MSEC do. The
+ * key no longer changes the load, as the pitch only changes what the
+ * interrupt renders; a key range checks that the melody stays playable.
+ *
+ *   cc -O2 -D__TINYTIMBER_POSIX -Ihost -I. -o edfAnalyzer \
+ *      host/edfAnalyzer.c melody.c
+ *   ./edfAnalyzer [-c costs] [-o us] [-t tempo[:max]] [-k key[:max]] [-v]
+ *
+ * The costs file gives the WCET of each method as a simulator script does
+ * (see host/peripherals.c), "cost <method|*> <us>", so a script that was
+ * tuned to the measured execution times (__USE_METHOD_STATS) can be given
+ * as it is. Lines "task <name> <period> <deadline> <wcet>", in us, add
+ * messages that the code does not declare, and "irq <name> <period>
+ * <deadline> <wcet>" interrupt handlers; other lines are ignored. -o adds
+ * a per-job overhead for the kernel (timer interrupt, dispatch) to every
+ * task.
+ *
+ * Interrupt handlers, audio_interrupt among them, preempt whatever message
+ * runs, whatever its deadline, so they are not scheduled by EDF. In any
+ * interval of length t they take at most ceil(t / period) * wcet, and that
+ * is added to the demand of the messages at every t: dbf(t) = sum over the
+ * messages of (floor((t - deadline) / period) + 1) * wcet, for t at least
+ * the deadline, + sum over the handlers of ceil(t / period) * wcet. A
+ * handler meets its own deadline if its response time, with every other
+ * handler counted as interference too, is within it.
+ *
+ * For one tempo and key the task set is listed with the result of the
+ * processor-demand test: the smallest slack t - dbf(t) over the absolute
+ * deadlines of the messages in the synchronous busy period, or deadline -
+ * response time of a handler, and how much the WCET of each task could
+ * grow before the set becomes infeasible. Given ranges, every
+ * configuration is checked, tempo by tempo, and the first infeasible one
+ * and the tightest one are reported (each one with -v).
+ */
+
+#include "audioEngine.h"
+#include "melody.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_TASKS 32
+#define MAX_COSTS 64
+#define TICK_USEC 10          // one kernel tick
+#define BUSY_LIMIT 60000000LL // longest busy period examined, in us
+
+#define TICKS(us) ((us) / TICK_USEC * TICK_USEC) // as USEC() truncates
+
+#ifdef TWINKLE
+#define NOTES TWINKLE_MELODY_FREQUENCY_INDICES
+#define BEATS TWINKLE_MELODY_BEATS
+#elif defined(PIRATES)
+#define NOTES PIRATES_MELODY_FREQUENCY_INDICES
+#define BEATS PIRATES_MELODY_BEATS
+#else
+#define NOTES MELODY_FREQUENCY_INDICES
+#define BEATS MELODY_BEATS
+#endif
+
+typedef struct {
+  char name[32];
+  long long period, deadline, wcet; // us
+  int irq;                          // an interrupt handler, not a message
+} Task;
+
+typedef struct {
+  char method[32];
+  long long us;
+} Cost;
+
+typedef struct {
+  int feasible;
+  const char *why; // if not
+  double utilization;
+  long long busy;  // synchronous busy period
+  long long slack; // least t - dbf(t)
+  long long at;    // the t of it
+} Result;
+
+static Cost costs[MAX_COSTS];
+static int ncosts = 0;
+static long long default_cost = -1;
+
+static Task extra[MAX_TASKS]; // "task" and "irq" lines
+static int nextra = 0;
+
+static long long overhead = 0;
+
+static void load_costs(const char *path) {
+  FILE *f = fopen(path, "r");
+  char buf[256], kind[8], name[32];
+  long long a, b, c;
+  int line = 0;
+
+  if (!f) {
+    perror(path);
+    exit(1);
+  }
+
+  while (fgets(buf, sizeof buf, f)) {
+    line++;
+    if (sscanf(buf, " cost %31s %lld", name, &a) == 2) {
+      if (!strcmp(name, "*"))
+        default_cost = a;
+      else if (ncosts < MAX_COSTS) {
+        snprintf(costs[ncosts].method, sizeof costs[0].method, "%s", name);
+        costs[ncosts++].us = a;
+      }
+    } else if (sscanf(buf, " %7s %31s %lld %lld %lld", kind, name, &a, &b,
+                      &c) == 5 &&
+               (!strcmp(kind, "task") || !strcmp(kind, "irq"))) {
+      if (nextra == MAX_TASKS || a <= 0 || b <= 0 || c < 0) {
+        fprintf(stderr, "%s:%d: bad %s\n", path, line, kind);
+        exit(1);
+      }
+      snprintf(extra[nextra].name, sizeof extra[0].name, "%s", name);
+      extra[nextra].period = a;
+      extra[nextra].deadline = b;
+      extra[nextra].wcet = c;
+      extra[nextra].irq = !strcmp(kind, "irq");
+      nextra++;
+    }
+  }
+
+  fclose(f);
+}
+
+static long long cost_of(const char *method) {
+  static int warned = 0;
+  int i;
+
+  for (i = 0; i < ncosts; i++)
+    if (!strcmp(costs[i].method, method))
+      return costs[i].us;
+  if (default_cost >= 0)
+    return default_cost;
+  if (!warned++)
+    fprintf(stderr, "edfAnalyzer: no cost for %s and no default, using 0\n",
+            method);
+  return 0;
+}
+
+static void add(Task *set, int *n, const char *name, const char *method,
+                long long period, long long deadline, int irq) {
+  Task *t = &set[(*n)++];
+
+  snprintf(t->name, sizeof t->name, "%s", name);
+  t->period = period;
+  t->deadline = deadline;
+  t->wcet = cost_of(method);
+  t->irq = irq;
+}
+
+/*
+ * The task set at tempo bpm and key offset key, or 0 with *why set if the
+ * melody cannot be played there at all.
+ */
+static int task_set(int bpm, int key, Task *set, int *n, const char **why) {
+  int i;
+  long long beat = 0;
+
+  for (i = 0; i < 32; i++) {
+    int note = NOTES[i] + key;
+    long long ms;
+
+    if (BEATS[i] <= 0) {
+      *why = "melody has a zero-length beat";
+      return 0;
+    }
+    if (note < MIN_FREQUENCY_INDICE || note > MAX_FREQUENCY_INDICE) {
+      *why = "note outside FREQUENCY_PERIODS";
+      return 0;
+    }
+    ms = (long long)(60000 / (bpm * BEATS[i])); // as player_tick computes it
+    if (!beat || ms < beat)
+      beat = ms;
+  }
+  if (beat <= GAP_SILENCE) {
+    *why = "beat not longer than GAP_SILENCE";
+    return 0;
+  }
+
+  *n = 0;
+  add(set, n, "audio_interrupt", "audio_interrupt", AUDIO_HALF_USEC,
+      AUDIO_HALF_USEC, 1);
+  add(set, n, "player_tick/mute", "player_tick", beat * 1000, beat * 1000, 0);
+  add(set, n, "player_tick/note", "player_tick", beat * 1000,
+      GAP_SILENCE * 1000, 0);
+  add(set, n, "led_tick", "led_tick", 60000LL / bpm / 2 * 1000, TICKS(100),
+      0);
+  for (i = 0; i < nextra && *n < MAX_TASKS; i++)
+    set[(*n)++] = extra[i];
+  for (i = 0; i < *n; i++)
+    set[i].wcet += overhead;
+  return 1;
+}
+
+// Most that the handlers but skip can take in an interval of length t.
+static long long interference(const Task *set, int n, long long t, int skip) {
+  long long load = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (set[i].irq && i != skip)
+      load += (t + set[i].period - 1) / set[i].period * set[i].wcet;
+  return load;
+}
+
+static long long dbf(const Task *set, int n, long long t) {
+  long long demand = interference(set, n, t, -1);
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (!set[i].irq && t >= set[i].deadline)
+      demand += ((t - set[i].deadline) / set[i].period + 1) * set[i].wcet;
+  return demand;
+}
+
+// Response time of handler i, or past its deadline if it has none within.
+static long long response(const Task *set, int n, int i) {
+  long long r = set[i].wcet, next;
+
+  while (r <= set[i].deadline) {
+    next = set[i].wcet + interference(set, n, r, i);
+    if (next == r)
+      break;
+    r = next;
+  }
+  return r;
+}
+
+// Processor-demand test over the absolute deadlines in the busy period.
+static Result analyse(const Task *set, int n) {
+  Result r = {1, NULL, 0, 0, 0, 0};
+  long long w = 0, next;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    r.utilization += (double)set[i].wcet / set[i].period;
+    w += set[i].wcet;
+  }
+  if (r.utilization > 1) {
+    r.feasible = 0;
+    r.why = "utilization above 1";
+    return r;
+  }
+
+  while (w > 0 && w < BUSY_LIMIT) {
+    for (next = 0, i = 0; i < n; i++)
+      next += (w + set[i].period - 1) / set[i].period * set[i].wcet;
+    if (next == w)
+      break;
+    w = next;
+  }
+  r.busy = w < BUSY_LIMIT ? w : BUSY_LIMIT;
+
+  for (i = 0; i < n; i++) {
+    long long t;
+
+    if (set[i].irq) {
+      long long slack = set[i].deadline - response(set, n, i);
+
+      t = set[i].deadline;
+      if (!r.at || slack < r.slack || (slack == r.slack && t < r.at)) {
+        r.slack = slack;
+        r.at = t;
+      }
+      continue;
+    }
+
+    // at least the first deadline, which may lie beyond the busy period
+    for (t = set[i].deadline; t <= r.busy || t == set[i].deadline;
+         t += set[i].period) {
+      long long slack = t - dbf(set, n, t);
+
+      if (!r.at || slack < r.slack || (slack == r.slack && t < r.at)) {
+        r.slack = slack;
+        r.at = t;
+      }
+    }
+  }
+  if (r.slack < 0) {
+    r.feasible = 0;
+    r.why = "demand exceeds time";
+  }
+  return r;
+}
+
+// How much the WCET of task i can grow with the set staying feasible.
+static long long wcet_slack(Task *set, int n, int i) {
+  long long wcet = set[i].wcet, low = 0, high = set[i].deadline;
+
+  while (low < high) {
+    long long mid = (low + high + 1) / 2;
+
+    set[i].wcet = wcet + mid;
+    if (analyse(set, n).feasible)
+      low = mid;
+    else
+      high = mid - 1;
+  }
+  set[i].wcet = wcet;
+  return low;
+}
+
+static void report(int bpm, int key, const Task *set, int n, Result r,
+                   const char *why) {
+  printf("tempo %d key %d: ", bpm, key);
+  if (why)
+    printf("not playable, %s\n", why);
+  else if (r.feasible)
+    printf("feasible, U %.3f, slack %lld us at %lld us\n", r.utilization,
+           r.slack, r.at);
+  else if (r.at)
+    printf("INFEASIBLE, U %.3f, demand exceeds time by %lld us at %lld us\n",
+           r.utilization, -r.slack, r.at);
+  else
+    printf("INFEASIBLE, U %.3f, %s\n", r.utilization, r.why);
+}
+
+static void detail(Task *set, int n, Result r) {
+  int i;
+
+  printf("%-20s %4s %10s %10s %8s %7s\n", "task", "kind", "period",
+         "deadline", "wcet", "util");
+  for (i = 0; i < n; i++)
+    printf("%-20s %4s %10lld %10lld %8lld %7.4f\n", set[i].name,
+           set[i].irq ? "irq" : "edf", set[i].period, set[i].deadline,
+           set[i].wcet, (double)set[i].wcet / set[i].period);
+  if (r.busy)
+    printf("busy period %lld us\n", r.busy);
+  if (!r.feasible)
+    return;
+  printf("wcet slack:");
+  for (i = 0; i < n; i++)
+    printf(" %s +%lld us%s", set[i].name, wcet_slack(set, n, i),
+           i < n - 1 ? "," : "\n");
+}
+
+static void range(const char *arg, int *low, int *high) {
+  char *end;
+
+  *low = *high = strtol(arg, &end, 10);
+  if (*end == ':')
+    *high = strtol(end + 1, &end, 10);
+  if (*end || *high < *low) {
+    fprintf(stderr, "edfAnalyzer: bad range %s\n", arg);
+    exit(2);
+  }
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: edfAnalyzer [-c costs] [-o us] [-t tempo[:max]] "
+                  "[-k key[:max]] [-v]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  int tempo_low = DEFAULT_BPM, tempo_high = DEFAULT_BPM;
+  int key_low = 0, key_high = 0;
+  int verbose = 0, configs = 0, infeasible = 0, bpm, key;
+  int first_bpm = 0, first_key = 0, tight_bpm = 0, tight_key = 0;
+  long long tightest = -1;
+  Task set[MAX_TASKS];
+  Result r = {0};
+  const char *why;
+  int c, n;
+
+  while ((c = getopt(argc, argv, "c:o:t:k:v")) != -1) {
+    switch (c) {
+    case 'c':
+      load_costs(optarg);
+      break;
+    case 'o':
+      overhead = atoll(optarg);
+      break;
+    case 't':
+      range(optarg, &tempo_low, &tempo_high);
+      break;
+    case 'k':
+      range(optarg, &key_low, &key_high);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc || tempo_low <= 0)
+    usage();
+
+  if (tempo_low == tempo_high && key_low == key_high) {
+    why = NULL;
+    if (task_set(tempo_low, key_low, set, &n, &why)) {
+      r = analyse(set, n);
+      report(tempo_low, key_low, set, n, r, NULL);
+      detail(set, n, r);
+    } else
+      report(tempo_low, key_low, set, 0, r, why);
+    return 0;
+  }
+
+  for (bpm = tempo_low; bpm <= tempo_high; bpm++) {
+    for (key = key_low; key <= key_high; key++) {
+      why = NULL;
+      configs++;
+      if (task_set(bpm, key, set, &n, &why))
+        r = analyse(set, n);
+      if (verbose)
+        report(bpm, key, set, n, r, why);
+      if (why || !r.feasible) {
+        if (!infeasible++) {
+          first_bpm = bpm;
+          first_key = key;
+        }
+      } else if (tightest < 0 || r.slack < tightest) {
+        tightest = r.slack;
+        tight_bpm = bpm;
+        tight_key = key;
+      }
+    }
+  }
+
+  printf("%d configurations, %d infeasible\n", configs, infeasible);
+  if (infeasible) {
+    printf("first infeasible: ");
+    why = NULL;
+    if (task_set(first_bpm, first_key, set, &n, &why))
+      r = analyse(set, n);
+    report(first_bpm, first_key, set, n, r, why);
+    if (!why)
+      detail(set, n, r);
+  }
+  if (tightest >= 0) {
+    printf("tightest feasible: ");
+    task_set(tight_bpm, tight_key, set, &n, &why);
+    r = analyse(set, n);
+    report(tight_bpm, tight_key, set, n, r, NULL);
+  }
+  return 0;
+}
@@ -0,0 +1,378 @@
+/*
+ * Runs an ensemble of boards on one host: each node is a process of the
+ * POSIX build of the music player (see stm32f4xx.h), with its own kernel,
+ * console and CAN node ID, and all of them share a virtual CAN bus.
+ *
+ *   cc -O2 -Ihost -o ensemble host/ensemble.c
+ *   ./ensemble [-n nodes] [-b bit/s] [-l us] [-o prefix] ./music-player
+ *
+ * A line "<node> <keys>" on stdin types the keys on the console of node
+ * <node>, or of every node if <node> is *. The output of node i goes to
+ * <prefix>i.log. At the end of the input the nodes are stopped and the
+ * bus statistics are printed:
+ *
+ *   latency  from a frame being transmitted by a node to its delivery to
+ *            the others: arbitration, transmission and the -l latency
+ *   skew     spread of the k-th LED-on (beat) between the nodes that blink
+ *
+ * The bus sends one frame at a time, each taking 47 + 8 * DLC bit times,
+ * and when it is free the pending frame with the lowest identifier wins
+ * arbitration. Frames are delivered to every node but the sender.
+ *
+ * Nodes are processes rather than threads because the kernel keeps its
+ * state in globals and takes interrupts as process-wide signals.
+ */
+
+#define _GNU_SOURCE
+#include "ensemble.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_NODES 64
+#define QUEUE 1024
+
+typedef struct {
+  pid_t pid;
+  int bus;     // our end of the node's bus socket, or -1 once it has exited
+  int console; // write end of the node's stdin
+  long long *beats;
+  int nbeats, beats_size;
+} Node;
+
+typedef struct {
+  BusPacket p;
+  int from;
+  long long at; // time of delivery, once transmitted
+} Frame;
+
+static Node nodes[MAX_NODES];
+static int nnodes = 4;
+static long long bitrate = 500000;
+static long long latency = 0; // ns
+static const char *prefix = "node";
+
+static Frame pending[QUEUE]; // waiting for the bus, in order of arrival
+static int npending = 0;
+
+static Frame sent[QUEUE]; // transmitted, waiting for delivery
+static int sent_head = 0, nsent = 0;
+
+static Frame onbus;
+static int busy = 0;
+static long long bus_free; // end of the transmission of onbus
+
+static long long frames = 0, lost = 0;
+static long long latency_min = -1, latency_max = 0, latency_sum = 0;
+
+static long long now_ns(void) {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static long long frame_ns(const CanTxMsg *f) {
+  return (47 + 8 * (f->DLC & 0x0F)) * 1000000000LL / bitrate;
+}
+
+static void start_node(int i, char **argv) {
+  int bus[2], console[2];
+  char value[32];
+  pid_t pid;
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, bus) ||
+      pipe2(console, O_CLOEXEC)) {
+    perror("ensemble");
+    exit(1);
+  }
+
+  if ((pid = fork()) < 0) {
+    perror("fork");
+    exit(1);
+  }
+
+  if (pid == 0) {
+    const char *per_node[] = {"TT_DAC_LOG", "TT_AUDIO_CAPTURE"};
+    char log[256];
+    int out;
+
+    snprintf(log, sizeof log, "%s%d.log", prefix, i);
+    if ((out = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+      perror(log);
+      _exit(1);
+    }
+    dup2(console[0], 0);
+    dup2(out, 1);
+    dup2(out, 2);
+    fcntl(bus[1], F_SETFD, 0);
+
+    snprintf(value, sizeof value, "%d", bus[1]);
+    setenv("TT_CAN_FD", value, 1);
+    snprintf(value, sizeof value, "%d", i);
+    setenv("TT_NODE_ID", value, 1);
+    for (int k = 0; k < 2; k++) { // one log and capture per node
+      char *file = getenv(per_node[k]), *path;
+
+      if (!file)
+        continue;
+      path = malloc(strlen(file) + 16);
+      sprintf(path, "%s.%d", file, i);
+      setenv(per_node[k], path, 1);
+    }
+
+    execv(argv[0], argv);
+    perror(argv[0]);
+    _exit(1);
+  }
+
+  close(bus[1]);
+  close(console[0]);
+  nodes[i].pid = pid;
+  nodes[i].bus = bus[0];
+  nodes[i].console = console[1];
+}
+
+// Type the keys of a "<node> <keys>" line.
+static void command(char *line) {
+  char *keys;
+  int i;
+
+  if (!(keys = strchr(line, ' ')))
+    return;
+  *keys++ = '\0';
+
+  for (i = 0; i < nnodes; i++)
+    if (!strcmp(line, "*") || atoi(line) == i)
+      if (write(nodes[i].console, keys, strlen(keys)) < 0)
+        perror("ensemble");
+}
+
+static void beat(Node *n, long long t) {
+  if (n->nbeats == n->beats_size) {
+    n->beats_size = n->beats_size ? 2 * n->beats_size : 256;
+    n->beats = realloc(n->beats, n->beats_size * sizeof *n->beats);
+  }
+  n->beats[n->nbeats++] = t;
+}
+
+static void receive(int i) {
+  BusPacket p;
+  ssize_t n = recv(nodes[i].bus, &p, sizeof p, 0);
+
+  if (n <= 0) { // the node has exited
+    close(nodes[i].bus);
+    nodes[i].bus = -1;
+    return;
+  }
+
+  if (p.type == BUS_LED)
+    beat(&nodes[i], p.time);
+  else if (npending == QUEUE)
+    lost++;
+  else {
+    pending[npending].p = p;
+    pending[npending].from = i;
+    npending++;
+  }
+}
+
+// Run the bus up to time now.
+static void bus(long long now) {
+  if (busy && bus_free <= now) {
+    if (nsent == QUEUE)
+      lost++;
+    else {
+      onbus.at = bus_free + latency;
+      sent[(sent_head + nsent++) % QUEUE] = onbus;
+    }
+    busy = 0;
+  }
+
+  if (!busy && npending) { // arbitration: lowest identifier first
+    int i, win = 0;
+
+    for (i = 1; i < npending; i++)
+      if (pending[i].p.frame.StdId < pending[win].p.frame.StdId)
+        win = i;
+    onbus = pending[win];
+    for (i = win; i < npending - 1; i++)
+      pending[i] = pending[i + 1];
+    npending--;
+
+    busy = 1;
+    bus_free = now + frame_ns(&onbus.p.frame);
+  }
+
+  while (nsent && sent[sent_head].at <= now) {
+    Frame *f = &sent[sent_head];
+    long long t = f->at - f->p.time;
+    int i;
+
+    for (i = 0; i < nnodes; i++)
+      if (i != f->from && nodes[i].bus >= 0)
+        if (send(nodes[i].bus, &f->p, sizeof f->p, MSG_DONTWAIT) < 0)
+          lost++;
+
+    frames++;
+    latency_sum += t;
+    if (latency_min < 0 || t < latency_min)
+      latency_min = t;
+    if (t > latency_max)
+      latency_max = t;
+
+    sent_head = (sent_head + 1) % QUEUE;
+    nsent--;
+  }
+}
+
+static void report(void) {
+  long long skew, skew_sum = 0, skew_max = 0;
+  int i, k, playing = 0, beats = -1;
+
+  printf("frames %lld, lost %lld\n", frames, lost);
+  if (frames)
+    printf("latency us: min %lld, mean %lld, max %lld\n", latency_min / 1000,
+           latency_sum / frames / 1000, latency_max / 1000);
+
+  for (i = 0; i < nnodes; i++) {
+    if (!nodes[i].nbeats)
+      continue;
+    playing++;
+    if (beats < 0 || nodes[i].nbeats < beats)
+      beats = nodes[i].nbeats;
+  }
+
+  for (k = 0; k < beats; k++) {
+    long long first = -1, last = 0;
+
+    for (i = 0; i < nnodes; i++) {
+      long long t;
+
+      if (!nodes[i].nbeats)
+        continue;
+      t = nodes[i].beats[k];
+      if (first < 0 || t < first)
+        first = t;
+      if (t > last)
+        last = t;
+    }
+    skew = last - first;
+    skew_sum += skew;
+    if (skew > skew_max)
+      skew_max = skew;
+  }
+
+  if (beats > 0)
+    printf("skew us over %d beats of %d nodes: mean %lld, max %lld\n", beats,
+           playing, skew_sum / beats / 1000, skew_max / 1000);
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: ensemble [-n nodes] [-b bit/s] [-l us] "
+                  "[-o prefix] node-program [args]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  struct pollfd fds[MAX_NODES + 1];
+  char line[256];
+  int c, i, length = 0, input = 1;
+
+  while ((c = getopt(argc, argv, "+n:b:l:o:")) != -1) {
+    switch (c) {
+    case 'n':
+      nnodes = atoi(optarg);
+      break;
+    case 'b':
+      bitrate = atoll(optarg);
+      break;
+    case 'l':
+      latency = atoll(optarg) * 1000;
+      break;
+    case 'o':
+      prefix = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind == argc || nnodes < 1 || nnodes > MAX_NODES || bitrate <= 0)
+    usage();
+
+  signal(SIGPIPE, SIG_IGN);
+  for (i = 0; i < nnodes; i++)
+    start_node(i, argv + optind);
+
+  while (input) {
+    long long now = now_ns(), next = now + 1000000000LL;
+    struct timespec timeout;
+
+    bus(now);
+    if (busy && bus_free < next)
+      next = bus_free;
+    if (nsent && sent[sent_head].at < next)
+      next = sent[sent_head].at;
+    if (!busy && npending)
+      next = now;
+    timeout.tv_sec = (next - now) / 1000000000;
+    timeout.tv_nsec = (next - now) % 1000000000;
+
+    fds[0].fd = 0;
+    fds[0].events = POLLIN;
+    for (i = 0; i < nnodes; i++) {
+      fds[i + 1].fd = nodes[i].bus;
+      fds[i + 1].events = POLLIN;
+    }
+
+    if (ppoll(fds, nnodes + 1, &timeout, NULL) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("ppoll");
+      break;
+    }
+
+    for (i = 0; i < nnodes; i++)
+      if (fds[i + 1].revents)
+        receive(i);
+
+    if (fds[0].revents) {
+      ssize_t n = read(0, line + length, sizeof line - 1 - length);
+      char *start = line, *end;
+
+      if (n <= 0) {
+        input = 0;
+        continue;
+      }
+      length += n;
+      line[length] = '\0';
+      while ((end = strchr(start, '\n'))) {
+        *end = '\0';
+        command(start);
+        start = end + 1;
+      }
+      length -= start - line;
+      memmove(line, start, length);
+      if (length == sizeof line - 1) // overlong line
+        length = 0;
+    }
+  }
+
+  for (i = 0; i < nnodes; i++) {
+    kill(nodes[i].pid, SIGTERM);
+    waitpid(nodes[i].pid, NULL, 0);
+  }
+
+  report();
+
+  return 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * Packets between a node and the virtual CAN bus of ensemble.c, sent over
+ * the SOCK_SEQPACKET socket that the node finds in $TT_CAN_FD. Times are
+ * CLOCK_MONOTONIC nanoseconds, which all processes on the host share.
+ */
+
+#ifndef HOST_ENSEMBLE_H
+#define HOST_ENSEMBLE_H
+
+#include "stm32f4xx.h"
+
+typedef struct {
+  enum {
+    BUS_FRAME, // node -> bus: frame transmitted; bus -> node: frame received
+    BUS_LED,   // node -> bus: the user LED changed to on
+  } type;
+  long long time; // when the frame was transmitted, or the LED changed
+  int on;
+  CanTxMsg frame;
+} BusPacket;
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * The queues of the original TinyTimber kernel, for the host benchmarks and
+ * tests to compare the kernel's queues with: singly linked lists kept
+ * sorted on insertion, with equal keys in FIFO order. Include it after
+ * TinyTimber.c.
+ */
+
+#ifndef HOST_LIST_QUEUE_H
+#define HOST_LIST_QUEUE_H
+
+typedef struct list_entry {
+  struct list_entry *next;
+  Time baseline;
+  Time deadline;
+  char infinite; // no deadline given
+  int id;
+} ListEntry;
+
+/* insert p behind every entry whose baseline is not after its own */
+static inline void listByBaseline(ListEntry *p, ListEntry **queue) {
+  ListEntry *prev = NULL, *q = *queue;
+  while (q && !TIME_BEFORE(p->baseline, q->baseline)) {
+    prev = q;
+    q = q->next;
+  }
+  p->next = q;
+  if (prev == NULL)
+    *queue = p;
+  else
+    prev->next = p;
+}
+
+/*
+ * Insert p behind every entry whose deadline is not after its own. An
+ * infinite deadline ranks after every finite one, as earlier() has it.
+ */
+static inline void listByDeadline(ListEntry *p, ListEntry **queue) {
+  ListEntry *prev = NULL, *q = *queue;
+  while (q && (p->infinite ||
+               (!q->infinite && !TIME_BEFORE(p->deadline, q->deadline)))) {
+    prev = q;
+    q = q->next;
+  }
+  p->next = q;
+  if (prev == NULL)
+    *queue = p;
+  else
+    prev->next = p;
+}
+
+static inline ListEntry *listDequeue(ListEntry **queue) {
+  ListEntry *p = *queue;
+  if (p)
+    *queue = p->next;
+  return p;
+}
+
+static inline int listRemove(ListEntry *p, ListEntry **queue) {
+  ListEntry *prev = NULL, *q = *queue;
+  while (q && q != p) {
+    prev = q;
+    q = q->next;
+  }
+  if (!q)
+    return 0;
+  if (prev)
+    prev->next = q->next;
+  else
+    *queue = q->next;
+  return 1;
+}
+
+#endif
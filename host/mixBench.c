@@ -0,0 +1,74 @@
+/*
+ * Cost of the audio engine's mixer: the time to render one half-buffer of
+ * AUDIO_HALF samples with 0 to AUDIO_VOICES notes sounding, each at its
+ * sustain level, as the share of the AUDIO_HALF_USEC of audio it makes.
+ * From what each further voice adds follows how many voices could be
+ * mixed in real time, per ms of CPU time. The host build mixes with the
+ * portable __SMLAD and __QADD16 of host/stm32f4xx.h, so the numbers compare
+ * voice counts and changes to render(), not the board's SIMD instructions.
+ *
+ * The engine is compiled into this file, for its render(), and linked with
+ * the kernel, which is never started:
+ *
+ *   cc -O2 -no-pie -D__TINYTIMBER_POSIX -Ihost -I. -o mixBench \
+ *      host/mixBench.c TinyTimber.c -lrt
+ *   ./mixBench [blocks]
+ *
+ * or make -C host bench.
+ */
+
+#include "audioEngine.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BLOCKS 200000
+#define SETTLE 100 // blocks for the attacks to reach sustain and the gain
+
+static AudioEngine engine = initAudioEngine(NULL);
+
+static long long clockNs(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// ns per block with n notes sounding, 440 Hz and the harmonics above
+static double bench(int n, int blocks) {
+  long long start;
+  int i;
+
+  for (i = 0; i < AUDIO_VOICES; i++)
+    engine.voices[i].stage = ENV_OFF;
+  for (i = 0; i < n; i++)
+    audio_note_on(&engine, 94489281 * (i + 1)); // 440 Hz * (i + 1)
+  for (i = 0; i < SETTLE; i++)
+    render(&engine, engine.buf);
+
+  start = clockNs();
+  for (i = 0; i < blocks; i++)
+    render(&engine, engine.buf + (i & 1) * AUDIO_HALF);
+  return (double)(clockNs() - start) / blocks;
+}
+
+int main(int argc, char **argv) {
+  int blocks = argc > 1 ? atoi(argv[1]) : BLOCKS;
+  double ns[AUDIO_VOICES + 1], perVoice;
+  int n;
+
+  build_wavetables();
+  audio_set_wave(&engine, WAVE_SINE);
+  audio_set_gain(&engine, 32767);
+
+  printf("voices  ns per block  us per ms of audio\n");
+  for (n = 0; n <= AUDIO_VOICES; n++) {
+    ns[n] = bench(n, blocks);
+    printf("%6d  %12.1f  %18.2f\n", n, ns[n], ns[n] / AUDIO_HALF_USEC);
+  }
+
+  perVoice = (ns[AUDIO_VOICES] - ns[0]) / AUDIO_VOICES / AUDIO_HALF_USEC;
+  printf("each voice %.3f us per ms of audio: %.0f voices per ms of CPU\n",
+         perVoice, 1000 / perVoice);
+  return 0;
+}
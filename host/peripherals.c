@@ -0,0 +1,586 @@
+/*
+ * Host emulation of the MD407 peripherals used by the application, for the
+ * POSIX build of TinyTimber (see stm32f4xx.h in this directory for how to
+ * build). Peripheral interrupts are requested with posix_interrupt(), which
+ * the kernel delivers like an IRQ: with interrupts disabled and possibly
+ * deferred until a critical section ends.
+ *
+ * In the simulator build (__TINYTIMBER_SIM) all input comes from the script
+ * named by $TT_SIM_SCRIPT instead, one event or setting per line:
+ *
+ *   start <us>                         time of startup, 0 by default
+ *   cost <method> <us>                 SIM_COST of a method, or * for all
+ *   <us> key <text>                    text typed on the console
+ *   <us> can <msgId> <nodeId> [<text>] frame received from another node
+ *   <us> button                        user button pressed or released
+ *   <us> end                           end of the simulation
+ *
+ * Times are simulated microseconds since startup, in nondecreasing order,
+ * and # starts a comment. A start time just below a multiple of 2^32 ticks
+ * (about 11.9 hours) makes the 32-bit kernel time wrap during the run.
+ */
+
+#include "TinyTimber.h"
+#include "audioEngine.h"
+#include "ensemble.h"
+#include "stm32f4xx.h"
+
+#ifdef __TINYTIMBER_SIM
+#include <dlfcn.h>
+#include <string.h>
+#endif
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+USART_TypeDef host_usart1;
+CAN_TypeDef host_can1, host_can2;
+GPIO_TypeDef host_gpiob = {GPIO_Pin_7, 0}; // button released (pulled up)
+int host_node_id = 0;
+
+static int bus_fd = -1; // socket to the virtual CAN bus of ensemble.c, or -1
+
+static int fd_ready(int fd) {
+  struct pollfd p = {fd, POLLIN, 0};
+
+  return poll(&p, 1, 0) > 0;
+}
+
+#ifdef __TINYTIMBER_SIM
+static long long host_usec(void) { return (long long)sim_time() * 10; }
+#else
+static struct timespec host_epoch;
+
+static long long host_usec(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - host_epoch.tv_sec) * 1000000LL +
+         (now.tv_nsec - host_epoch.tv_nsec) / 1000;
+}
+#endif
+
+// USART1: stdin and stdout
+
+static int rx_data = -1; // received character not yet read, or -1
+static int rx_eof = 0;
+
+#ifdef __TINYTIMBER_SIM
+#define KEY_BUFFER 64
+
+static char keys[KEY_BUFFER]; // scripted key input not yet received
+static int keys_head = 0, keys_count = 0;
+
+static int stdin_ready(void) { return keys_count > 0; }
+
+static int stdin_read(unsigned char *c) {
+  *c = keys[keys_head];
+  keys_head = (keys_head + 1) % KEY_BUFFER;
+  keys_count--;
+  return 1;
+}
+
+static void stdin_init(void) {}
+#else
+static int stdin_flags = -1;
+
+static int stdin_ready(void) { return !rx_eof && fd_ready(0); }
+
+// SIGIO: input on stdin or from the bus
+static void io_signal(int sig) {
+  (void)sig;
+  if (host_usart1.receive_interrupt && stdin_ready())
+    posix_interrupt(IRQ_USART1);
+  if (host_can1.receive_interrupt && bus_fd >= 0 && fd_ready(bus_fd))
+    posix_interrupt(IRQ_CAN1);
+}
+
+// Have fd raise SIGIO when there is input, and return its old flags.
+static int io_async(int fd) {
+  static int installed = 0;
+  int flags = fcntl(fd, F_GETFL);
+
+  if (!installed) {
+    struct sigaction sa;
+
+    sa.sa_handler = io_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGIO, &sa, NULL);
+    installed = 1;
+  }
+
+  fcntl(fd, F_SETOWN, getpid());
+  fcntl(fd, F_SETFL, flags | O_ASYNC);
+
+  return flags;
+}
+
+static void stdin_restore(void) { fcntl(0, F_SETFL, stdin_flags); }
+
+static void stdin_init(void) {
+  if (stdin_flags != -1)
+    return;
+
+  stdin_flags = io_async(0);
+  atexit(stdin_restore);
+}
+
+static int stdin_read(unsigned char *c) { return read(0, c, 1); }
+#endif
+
+void USART_ITConfig(USART_TypeDef *usart, uint16_t it, FunctionalState state) {
+  if (it == USART_IT_RXNE) {
+    usart->receive_interrupt = state;
+
+    stdin_init();
+
+    if (state && stdin_ready()) // input that arrived before we listened
+      posix_interrupt(IRQ_USART1);
+  } else if (it == USART_IT_TXE) {
+    usart->transmit_interrupt = state;
+
+    if (state) // stdout is always ready
+      posix_interrupt(IRQ_USART1);
+  }
+}
+
+FlagStatus USART_GetFlagStatus(USART_TypeDef *usart, uint16_t flag) {
+  (void)usart; // USART1 is the only one
+  if (flag == USART_FLAG_TXE)
+    return SET;
+
+  if (rx_data < 0 && stdin_ready()) {
+    unsigned char c;
+
+    if (stdin_read(&c) == 1)
+      rx_data = c;
+    else
+      rx_eof = 1;
+  }
+
+  return rx_data >= 0 ? SET : RESET;
+}
+
+uint16_t USART_ReceiveData(USART_TypeDef *usart) {
+  int c = rx_data;
+
+  rx_data = -1;
+
+  // Regular files do not raise SIGIO, so keep interrupting while there is
+  // more to read.
+  if (usart->receive_interrupt && stdin_ready())
+    posix_interrupt(IRQ_USART1);
+
+  return c < 0 ? 0 : c;
+}
+
+void USART_SendData(USART_TypeDef *usart, uint16_t data) {
+  char c = data;
+
+  if (c != '\r')
+    write(1, &c, 1);
+
+  if (usart->transmit_interrupt)
+    posix_interrupt(IRQ_USART1);
+}
+
+// CAN1 and CAN2: every frame sent is received in CAN1 FIFO 0, unless the
+// node is on the bus of ensemble.c, which delivers the frames of the others
+
+#define CAN_FIFO_DEPTH 3
+
+static CanRxMsg can_fifo[CAN_FIFO_DEPTH];
+static int can_head = 0, can_count = 0;
+
+static int can_push(const CanTxMsg *msg) {
+  CanRxMsg *rx;
+
+  if (can_count == CAN_FIFO_DEPTH) // FIFO overrun, the frame is lost
+    return 0;
+
+  rx = &can_fifo[(can_head + can_count) % CAN_FIFO_DEPTH];
+  rx->StdId = msg->StdId;
+  rx->ExtId = msg->ExtId;
+  rx->IDE = msg->IDE;
+  rx->RTR = msg->RTR;
+  rx->DLC = msg->DLC;
+  for (int i = 0; i < 8; i++)
+    rx->Data[i] = msg->Data[i];
+  rx->FMI = 0;
+  can_count++;
+
+  return 1;
+}
+
+static void bus_send(BusPacket *p) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  p->time = now.tv_sec * 1000000000LL + now.tv_nsec;
+  send(bus_fd, p, sizeof *p, 0);
+}
+
+// Move frames waiting on the bus socket into the FIFO.
+static void bus_receive(void) {
+  BusPacket p;
+
+  while (bus_fd >= 0 && can_count < CAN_FIFO_DEPTH && fd_ready(bus_fd) &&
+         recv(bus_fd, &p, sizeof p, 0) == sizeof p)
+    can_push(&p.frame);
+}
+
+void CAN_StructInit(CAN_InitTypeDef *init) { (void)init; }
+
+uint8_t CAN_Init(CAN_TypeDef *can, CAN_InitTypeDef *init) {
+  (void)can;
+  (void)init;
+  return CAN_InitStatus_Success;
+}
+
+void CAN_ITConfig(CAN_TypeDef *can, uint32_t it, FunctionalState state) {
+  if (it == CAN_IT_FMP0)
+    can->receive_interrupt = state;
+}
+
+FlagStatus CAN_GetFlagStatus(CAN_TypeDef *can, uint32_t flag) {
+  (void)flag; // only ever CAN_FLAG_FMP0
+  bus_receive();
+
+  return can == CAN1 && can_count > 0 ? SET : RESET;
+}
+
+void CAN_Receive(CAN_TypeDef *can, uint8_t fifo, CanRxMsg *msg) {
+  (void)fifo; // CAN1 has the one
+  if (can != CAN1 || can_count == 0)
+    return;
+
+  *msg = can_fifo[can_head];
+  can_head = (can_head + 1) % CAN_FIFO_DEPTH;
+  can_count--;
+
+  bus_receive();
+  if (can_count > 0 && CAN1->receive_interrupt)
+    posix_interrupt(IRQ_CAN1);
+}
+
+uint8_t CAN_Transmit(CAN_TypeDef *can, CanTxMsg *msg) {
+  (void)can; // both ports are on the same bus
+  if (bus_fd >= 0) {
+    BusPacket p = {.type = BUS_FRAME};
+
+    p.frame = *msg;
+    bus_send(&p);
+  } else if (can_push(msg) && CAN1->receive_interrupt)
+    posix_interrupt(IRQ_CAN1);
+
+  return 0;
+}
+
+uint8_t CAN_TransmitStatus(CAN_TypeDef *can, uint8_t mailbox) {
+  (void)can;
+  (void)mailbox;
+  return CAN_TxStatus_Ok;
+}
+
+// GPIOB and EXTI line 7: the user button, toggled by SIGUSR2
+
+static EXTITrigger_TypeDef button_trigger = EXTI_Trigger_Falling;
+static int button_pending = 0;
+
+static void button_toggle(void) {
+  int rising;
+
+  host_gpiob.input ^= GPIO_Pin_7;
+  rising = (host_gpiob.input & GPIO_Pin_7) != 0;
+
+  if (button_trigger == EXTI_Trigger_Rising_Falling ||
+      button_trigger == (rising ? EXTI_Trigger_Rising : EXTI_Trigger_Falling)) {
+    button_pending = 1;
+    posix_interrupt(IRQ_EXTI9_5);
+  }
+}
+
+#ifndef __TINYTIMBER_SIM
+static void button_signal(int sig) {
+  (void)sig;
+  button_toggle();
+}
+#endif
+
+uint8_t GPIO_ReadInputDataBit(GPIO_TypeDef *gpio, uint16_t pin) {
+  return (gpio->input & pin) != 0;
+}
+
+// On the bus, tell ensemble.c each time the user LED (GPIOB pin 0) goes on.
+static void led_report(GPIO_TypeDef *gpio, uint16_t old) {
+  BusPacket p = {.type = BUS_LED};
+
+  if (bus_fd < 0 || gpio != GPIOB || !(~old & gpio->output & GPIO_Pin_0))
+    return;
+
+  p.on = 1;
+  bus_send(&p);
+}
+
+void GPIO_WriteBit(GPIO_TypeDef *gpio, uint16_t pin, BitAction value) {
+  uint16_t old = gpio->output;
+
+  if (value)
+    gpio->output |= pin;
+  else
+    gpio->output &= ~pin;
+
+  led_report(gpio, old);
+}
+
+void GPIO_ToggleBits(GPIO_TypeDef *gpio, uint16_t pin) {
+  uint16_t old = gpio->output;
+
+  gpio->output ^= pin;
+
+  led_report(gpio, old);
+}
+
+void EXTI_StructInit(EXTI_InitTypeDef *init) {
+  init->EXTI_Line = 0;
+  init->EXTI_Mode = EXTI_Mode_Interrupt;
+  init->EXTI_Trigger = EXTI_Trigger_Falling;
+  init->EXTI_LineCmd = DISABLE;
+}
+
+void EXTI_Init(EXTI_InitTypeDef *init) {
+  if (init->EXTI_Line == EXTI_Line7)
+    button_trigger = init->EXTI_Trigger;
+}
+
+ITStatus EXTI_GetITStatus(uint32_t line) {
+  return line == EXTI_Line7 && button_pending ? SET : RESET;
+}
+
+void EXTI_ClearITPendingBit(uint32_t line) {
+  if (line == EXTI_Line7)
+    button_pending = 0;
+}
+
+// DAC: the host sink is given each half-buffer as it is filled, and logs
+// every change of the DAC at the time the sample would be converted. It can
+// also capture the whole stream to $TT_AUDIO_CAPTURE, as raw 16-bit host
+// order samples of 12 bits at AUDIO_RATE.
+
+static FILE *dac_log = NULL, *dac_capture = NULL;
+static int dac_value = -1;
+
+static void host_sink_start(uint16_t *buf, int n) {
+  (void)buf; // played as it is filled
+  (void)n;
+}
+
+static int host_sink_played(void) { return 0; } // the engine keeps time
+
+static void host_sink_filled(const uint16_t *half, int n) {
+  long long now = host_usec();
+
+  if (dac_capture)
+    fwrite(half, sizeof *half, n, dac_capture);
+
+  for (int i = 0; i < n; i++) {
+    if (half[i] == dac_value)
+      continue;
+
+    dac_value = half[i];
+
+    if (dac_log)
+      fprintf(dac_log, "%lld %d\n", now + (long long)i * AUDIO_SAMPLE_USEC,
+              dac_value);
+  }
+}
+
+const SampleSink host_sink = {host_sink_start, host_sink_played,
+                              host_sink_filled};
+
+#ifdef __TINYTIMBER_SIM
+// Simulator script
+
+#define SCRIPT_EVENTS 256
+
+typedef struct {
+  LongTime at;
+  enum { KEY, CAN, BUTTON, END } kind;
+  int msg_id, node_id;
+  char text[32];
+} ScriptEvent;
+
+static ScriptEvent script[SCRIPT_EVENTS];
+static int script_length = 0, script_next = 0;
+static LongTime script_start = 0;
+
+static void script_error(const char *path, int line, const char *what) {
+  fprintf(stderr, "%s:%d: %s\n", path, line, what);
+  exit(1);
+}
+
+static void script_cost(const char *path, int line, char *args) {
+  char name[64];
+  long usec;
+  Method meth = NULL;
+
+  if (sscanf(args, "%63s %ld", name, &usec) != 2)
+    script_error(path, line, "expected cost <method> <us>");
+
+  // the executable must be linked with -rdynamic for dlsym to find methods
+  if (strcmp(name, "*") && !(meth = (Method)dlsym(RTLD_DEFAULT, name)))
+    script_error(path, line, "unknown method");
+
+  SIM_COST(meth, USEC(usec));
+}
+
+static void script_load(const char *path) {
+  FILE *f = fopen(path, "r");
+  char buf[256], kind[16];
+  long long usec;
+  int line = 0, n;
+
+  if (!f) {
+    perror(path);
+    exit(1);
+  }
+
+  while (fgets(buf, sizeof buf, f)) {
+    ScriptEvent *e = &script[script_length];
+    char *text, *end;
+
+    line++;
+    if ((end = strpbrk(buf, "#\r\n")))
+      *end = '\0';
+
+    if (sscanf(buf, " %15s%n", kind, &n) != 1)
+      continue; // blank line
+    if (!strcmp(kind, "start")) {
+      if (script_length > 0 || sscanf(buf + n, "%lld", &usec) != 1)
+        script_error(path, line, "expected start <us> before any event");
+      sim_start(script_start = usec / 10);
+      continue;
+    }
+    if (!strcmp(kind, "cost")) {
+      script_cost(path, line, buf + n);
+      continue;
+    }
+
+    if (script_length == SCRIPT_EVENTS)
+      script_error(path, line, "too many events");
+    if (sscanf(buf, " %lld %15s%n", &usec, kind, &n) != 2)
+      script_error(path, line, "expected <us> <event>");
+    e->at = script_start + usec / 10;
+    if (script_length > 0 && e->at < script[script_length - 1].at)
+      script_error(path, line, "events out of order");
+
+    text = buf + n + strspn(buf + n, " \t");
+    e->text[0] = '\0';
+    if (!strcmp(kind, "key")) {
+      e->kind = KEY;
+      snprintf(e->text, sizeof e->text, "%s", text);
+    } else if (!strcmp(kind, "can")) {
+      e->kind = CAN;
+      if (sscanf(text, "%d %d %31s", &e->msg_id, &e->node_id, e->text) < 2)
+        script_error(path, line, "expected can <msgId> <nodeId> [<text>]");
+    } else if (!strcmp(kind, "button"))
+      e->kind = BUTTON;
+    else if (!strcmp(kind, "end"))
+      e->kind = END;
+    else
+      script_error(path, line, "unknown event");
+    script_length++;
+  }
+
+  fclose(f);
+}
+
+int sim_next_input(Time *at) {
+  if (script_next == script_length)
+    return 0;
+
+  *at = (Time)script[script_next].at;
+  return 1;
+}
+
+void sim_input(void) {
+  ScriptEvent *e = &script[script_next++];
+  CanTxMsg frame = {0};
+  int i;
+
+  switch (e->kind) {
+  case KEY:
+    for (i = 0; e->text[i] && keys_count < KEY_BUFFER; i++)
+      keys[(keys_head + keys_count++) % KEY_BUFFER] = e->text[i];
+    if (host_usart1.receive_interrupt)
+      posix_interrupt(IRQ_USART1);
+    break;
+  case CAN:
+    frame.StdId = (e->msg_id << 4) + e->node_id;
+    frame.DLC = strlen(e->text) < 8 ? strlen(e->text) : 8;
+    for (i = 0; i < frame.DLC; i++)
+      frame.Data[i] = e->text[i];
+    CAN_Transmit(CAN2, &frame);
+    break;
+  case BUTTON:
+    button_toggle();
+    break;
+  case END:
+    fprintf(stderr, "Simulated %lld us in %ld ms\n",
+            host_usec() - script_start * 10,
+            (long)(clock() * 1000 / CLOCKS_PER_SEC));
+    exit(0);
+  }
+}
+#endif
+
+// Runs before main(), in place of startup.c on the board.
+__attribute__((constructor)) static void host_init(void) {
+  char *path = getenv("TT_DAC_LOG");
+  char *capture = getenv("TT_AUDIO_CAPTURE");
+  char *node = getenv("TT_NODE_ID");
+
+  if (node)
+    host_node_id = atoi(node) & 0x0F;
+#ifdef __TINYTIMBER_SIM
+  char *script_path = getenv("TT_SIM_SCRIPT");
+
+  if (script_path)
+    script_load(script_path);
+#else
+  struct sigaction sa;
+  char *bus = getenv("TT_CAN_FD");
+
+  clock_gettime(CLOCK_MONOTONIC, &host_epoch);
+
+  sa.sa_handler = button_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR2, &sa, NULL);
+
+  if (bus) {
+    bus_fd = atoi(bus);
+    io_async(bus_fd);
+  }
+#endif
+
+  if (path && !(dac_log = fopen(path, "w")))
+    perror(path);
+  else if (dac_log)
+    setvbuf(dac_log, NULL, _IOLBF, 0); // keep the log when interrupted
+
+  if (capture && !(dac_capture = fopen(capture, "wb")))
+    perror(capture);
+
+#ifndef __TINYTIMBER_SIM
+  fprintf(stderr, "kill -USR2 %d presses or releases the user button\n",
+          (int)getpid());
+#endif
+}
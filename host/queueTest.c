@@ -0,0 +1,307 @@
+/*
+ * Checks the order in which the kernel dispatches messages against the
+ * queues of the original kernel (listQueue.h). A seeded random sequence
+ * posts messages with and without a delay and a deadline, aborts some of
+ * them (and through stale handles some that are done), lets time pass so
+ * that timers expire, and takes messages off the ready queue as run()
+ * does; every message taken must be the one that the lists give. The clock
+ * starts shortly before 2^31 ticks, so the sequence crosses the signed
+ * wrap.
+ *
+ * The lists are the original ones but for messages without a deadline,
+ * which the original gave the deadline baseline + INFINITY: that overflows
+ * for any baseline past 0, so they ranked before or after finite deadlines
+ * depending on their baselines, and among themselves by baseline. The
+ * kernel ranks them after every finite deadline and in the order they
+ * became ready, on purpose, and so do the lists here. earlier(), which
+ * decides preemption, is checked to agree on two of them that became
+ * ready in the opposite order to their baselines.
+ *
+ * Then SYNC is checked through the fast path, with a signal handler
+ * coming between its test and its store, and in the kernel: uncontended,
+ * on an object that the caller holds, and contended, where the owner must
+ * leave its fast unlock to the critical section to hand the object over.
+ *
+ * The kernel is compiled into this file as the simulator build, whose
+ * clock is a variable:
+ *
+ *   cc -O2 -no-pie -D__TINYTIMBER_SIM [-D__USE_TIMER_WHEEL] -Ihost -I. \
+ *      -o queueTest host/queueTest.c -lrt
+ *   ./queueTest [seed [steps]]
+ *
+ * or make -C host check, which runs it with and without the wheel.
+ */
+
+#include "TinyTimber.c"
+#include "listQueue.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SEEDS 20
+#define STEPS 200000
+#define START ((Time)0x7FFFFFFF - 50000) // ticks, 0.5 s before the wrap
+
+static uint32_t seed, testSeed;
+static Object receiver = initObject();
+static ListEntry entries[NMSGS]; // entries[i] stands for messages[i]
+static Msg handles[NMSGS];
+static Msg done[NMSGS]; // handles of messages that are done, now stale
+static int doneCount;
+static ListEntry *listTimers, *listReady;
+static int posted, dispatched, aborted;
+
+static Object target = initObject();
+static Object low = initObject(), high = initObject();
+static char syncLog[16]; // the steps of the SYNC checks, in order
+static int syncLogged, syncDone;
+
+// The simulator build takes its input from peripherals.c, not needed here.
+int sim_next_input(Time *at) { return 0; }
+void sim_input(void) {}
+
+static int nothing(Object *self, int arg) { return 0; }
+
+static uint32_t random32(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static void send_one(void) {
+  Time bl = random32() % 3 ? random32() % 1000 + 1 : 0;
+  Time dl = random32() % 4 ? random32() % 2000 + 1 : 0;
+  ListEntry *p;
+  Msg h;
+
+  if (!msgPool)
+    return;
+  h = async(bl, dl, &receiver, nothing, posted);
+  p = &entries[HANDLE_INDEX(h)];
+  handles[HANDLE_INDEX(h)] = h;
+  p->id = posted++;
+  p->baseline = TIME_ADD(timestamp, bl);
+  p->deadline = TIME_ADD(p->baseline, dl);
+  p->infinite = dl == 0;
+  if (bl > 0)
+    listByBaseline(p, &listTimers);
+  else
+    listByDeadline(p, &listReady);
+}
+
+static void abort_one(void) {
+  int i = random32() % NMSGS;
+
+  if (random32() % 2) {
+    ABORT(done[i]); // must be ignored, even if the block has been reused
+    return;
+  }
+  if (messages[i].state == MSG_FREE)
+    return;
+  ABORT(handles[i]);
+  if (!listRemove(&entries[i], &listTimers))
+    listRemove(&entries[i], &listReady);
+  done[doneCount++ % NMSGS] = handles[i];
+  aborted++;
+}
+
+static void advance(void) {
+  timestamp = TIME_ADD(timestamp, random32() % 500);
+  simNow = timestamp;
+  expire(timestamp);
+  while (listTimers && !TIME_BEFORE(timestamp, listTimers->baseline))
+    listByDeadline(listDequeue(&listTimers), &listReady);
+}
+
+static int dispatch_one(int step) {
+  ListEntry *p = listDequeue(&listReady);
+  Message m = readyTop(&msgQ) ? dequeueReady(&msgQ) : NULL;
+
+  if (!p && !m)
+    return 1;
+  if (!p || !m || m->arg != p->id) {
+    printf("queueTest: seed %u, step %d at time %d: dispatched %d, "
+           "expected %d\n",
+           testSeed, step, timestamp, m ? m->arg : -1, p ? p->id : -1);
+    return 0;
+  }
+  recycle(m);
+  done[doneCount++ % NMSGS] = handles[m - messages];
+  dispatched++;
+  return 1;
+}
+
+static void reset(void) {
+  int i;
+
+  msgPool = messages;
+  msgPoolTail = &messages[NMSGS - 1];
+  for (i = 0; i < NMSGS; i++) {
+    messages[i].next = i + 1 < NMSGS ? &messages[i + 1] : NULL;
+    messages[i].heapIndex = -1;
+    messages[i].state = MSG_FREE;
+  }
+  poolUsed = 0;
+  timerQ.size = msgQ.timed.size = 0;
+  msgQ.head = msgQ.tail = NULL;
+#ifdef __USE_TIMER_WHEEL
+  memset(wheelHead, 0, sizeof wheelHead);
+  memset(wheelTail, 0, sizeof wheelTail);
+  memset(wheelBusy, 0, sizeof wheelBusy);
+  wheelCount = 0;
+#endif
+  listTimers = listReady = NULL;
+  simNow = timestamp = START;
+}
+
+static int test(uint32_t s, int steps) {
+  int i;
+
+  seed = testSeed = s;
+  reset();
+  for (i = 0; i < steps; i++) {
+    uint32_t r = random32() % 10;
+    if (r < 4)
+      send_one();
+    else if (r < 5)
+      abort_one();
+    else if (r < 7)
+      advance();
+    else if (!dispatch_one(i))
+      return 0;
+  }
+  return 1;
+}
+
+// two messages without deadlines, ready in the opposite order to baselines
+static int infinites(void) {
+  Message first, second;
+
+  reset();
+  first = &messages[HANDLE_INDEX(async(0, 0, &receiver, nothing, 1))];
+  timestamp = START - 10; // as if sent by an older message
+  second = &messages[HANDLE_INDEX(async(0, 0, &receiver, nothing, 2))];
+  if (!earlier(first, second) || earlier(second, first) ||
+      readyTop(&msgQ) != first || dequeueReady(&msgQ) != first ||
+      dequeueReady(&msgQ) != second) {
+    printf("queueTest: infinite deadlines out of ready order\n");
+    return 0;
+  }
+  recycle(first);
+  recycle(second);
+  return 1;
+}
+
+static int fail(const char *what) {
+  printf("queueTest: SYNC %s\n", what);
+  return 0;
+}
+
+static int monitor(void) {
+  Object o = initObject();
+
+  if (!fastLock(&o) || o.ownedBy != current)
+    return fail("fast lock failed");
+  if (fastLock(&o))
+    return fail("fast lock of a locked object");
+  if (!fastUnlock(&o) || o.ownedBy)
+    return fail("fast unlock failed");
+
+  posixLoadExclusive(&o.ownedBy);
+  posixClearExclusive(); // a handler between the test and the store
+  if (posixStoreExclusive(&o.ownedBy, NULL, current) || o.ownedBy)
+    return fail("store after a handler");
+
+  posixStore.to = &o.ownedBy;
+  posixStore.from = NULL;
+  posixStore.value = current;
+  posixMonitor = MONITOR_STORING;
+  posixClearExclusive(); // a handler between the commit and the store
+  if (o.ownedBy != current || posixMonitor != MONITOR_OPEN)
+    return fail("store not made by a handler");
+
+  o.wantedBy = current;
+  if (fastUnlock(&o) || o.ownedBy != current)
+    return fail("fast unlock of a wanted object");
+  o.ownedBy = NULL;
+  if (fastLock(&o) || o.ownedBy)
+    return fail("fast lock of a wanted object");
+  return 1;
+}
+
+static int owned(Object *self, int step) {
+  syncLog[syncLogged++] = step;
+  return self->ownedBy == current;
+}
+
+// high: preempts hold, and waits for low to hand over target
+static int contend(Object *self, int unused) {
+  syncLog[syncLogged++] = 'c';
+  if (SYNC(&target, owned, 'o') == 1)
+    syncLog[syncLogged++] = 'C';
+  return 0;
+}
+
+// target, locked by low
+static int hold(Object *self, int unused) {
+  syncLog[syncLogged++] = 'h';
+  BEFORE(USEC(10), &high, contend, 0);
+  syncLog[syncLogged++] = 'H';
+  return 0;
+}
+
+static int syncChecks(Object *self) {
+  if (SYNC(&target, owned, 'u') != 1 || target.ownedBy)
+    return fail("uncontended");
+  if (SYNC(self, owned, 'd') != -1) // self is locked by this message
+    return fail("of the caller's own object");
+  SYNC(&target, hold, 0);
+  if (strcmp(syncLog, "uhcHoC") || target.ownedBy) {
+    printf("queueTest: SYNC contended, steps %s, expected uhcHoC\n",
+           syncLog);
+    return 0;
+  }
+  printf("queueTest: SYNC passed\n");
+  return 1;
+}
+
+static int checkSync(Object *self, int unused) {
+  int passed = syncChecks(self);
+
+  syncDone = 1;
+  exit(!passed);
+}
+
+static void syncEnded(void) {
+  if (syncDone)
+    return;
+  printf("queueTest: SYNC did not finish, steps %s\n", syncLog);
+  fflush(stdout);
+  _exit(1); // the simulation ended before the checks did
+}
+
+int main(int argc, char **argv) {
+  uint32_t first = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+  int seeds = argc > 1 ? 1 : SEEDS;
+  int steps = argc > 2 ? atoi(argv[2]) : STEPS;
+  int i;
+
+  runAsHardware = 1; // baselines are taken from timestamp
+  DISABLE();         // so that posting never dispatches
+  for (i = 0; i < seeds; i++)
+    if (!test(first + i, steps))
+      return 1;
+  if (!infinites())
+    return 1;
+  printf("queueTest: passed, %d posted, %d dispatched, %d aborted\n", posted,
+         dispatched, aborted);
+
+  fflush(stdout);
+  if (!monitor())
+    return 1;
+  reset();
+  runAsHardware = 0;
+  atexit(syncEnded);
+  return tinytimber(&low, (Method)checkSync, 0);
+}
@@ -0,0 +1,189 @@
+/*
+ * Time spent with interrupts disabled per SEND of a timed message, with n
+ * timers pending, against the sorted list of the original kernel
+ * (listQueue.h). Of the critical section in post() only release() depends
+ * on the timer queue: it queues the message and sets the timer compare to
+ * the earliest baseline. The list does the same with an insertion into the
+ * sorted list. The queue is held at n timers by sending one message for
+ * each that expires, each delay at random up to the span ticks given, and
+ * the mean and the 99th percentile are in ns, with the cost of reading the
+ * clock taken off.
+ *
+ * The kernel is compiled into this file as the simulator build, whose
+ * clock is a variable, and NMSGS must be at least the largest n. Add
+ * -D__USE_TIMER_WHEEL to measure the timing wheel in front of the heap:
+ *
+ *   cc -O2 -no-pie -D__TINYTIMBER_SIM -DNMSGS=1024 [-D__USE_TIMER_WHEEL] \
+ *      -Ihost -I. -o sendBench host/sendBench.c -lrt
+ *   ./sendBench [rounds]
+ *
+ * or make -C host bench, which runs both.
+ */
+
+#include "TinyTimber.c"
+#include "listQueue.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SAMPLES 100000
+#define BUCKETS 10000 // of the histogram, 1 ns each
+
+static const int sizes[] = {30, 256, 1024};
+static const int spans[] = {__TIMER_WHEEL_SLOTS - 1, 65536};
+
+#ifdef __USE_TIMER_WHEEL
+#define QUEUE "wheel"
+#else
+#define QUEUE "heap"
+#endif
+
+static uint32_t seed;
+static ListEntry entries[NMSGS];
+static ListEntry *listTimers;
+
+// The simulator build takes its input from peripherals.c, not needed here.
+int sim_next_input(Time *at) { return 0; }
+void sim_input(void) {}
+
+static uint32_t random32(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static long long clockNs(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+typedef struct {
+  long long total;
+  int count;
+  int histogram[BUCKETS];
+} Cost;
+
+static Cost cost;
+static long long overhead; // of a clockNs() pair
+
+static void charge(long long start) {
+  long long ns = clockNs() - start - overhead;
+  cost.total += ns;
+  cost.count++;
+  cost.histogram[ns < 0 ? 0 : ns < BUCKETS ? ns : BUCKETS - 1]++;
+}
+
+static void report(int n, int span, const char *queue) {
+  int i, seen = 0;
+  for (i = 0; i < BUCKETS - 1; i++)
+    if ((seen += cost.histogram[i]) >= cost.count * 0.99)
+      break;
+  printf("%6d %6d  %-6s %8.1f %8d\n", n, span, queue,
+         (double)cost.total / cost.count, i);
+  memset(&cost, 0, sizeof cost);
+}
+
+static void benchKernel(int n, int span, int rounds) {
+  Message m;
+  int i;
+
+  timerQ.size = 0;
+#ifdef __USE_TIMER_WHEEL
+  memset(wheelHead, 0, sizeof wheelHead);
+  memset(wheelTail, 0, sizeof wheelTail);
+  memset(wheelBusy, 0, sizeof wheelBusy);
+  wheelCount = 0;
+#endif
+  simNow = 0;
+  for (i = 0; i < n; i++) {
+    messages[i].infinite = 0;
+    messages[i].baseline = random32() % span + 1;
+    messages[i].deadline = TIME_ADD(messages[i].baseline, span);
+    release(&messages[i]);
+  }
+
+  for (i = 0; i < rounds; i++) {
+    Message expired[NMSGS];
+    int k = 0;
+
+    simNow = simCompare;
+    expire((Time)simNow);
+    while (readyTop(&msgQ))
+      expired[k++] = dequeueReady(&msgQ);
+
+    while (k--) {
+      long long start;
+      m = expired[k];
+      m->baseline = TIME_ADD(simNow, random32() % span + 1);
+      m->deadline = TIME_ADD(m->baseline, span);
+      start = clockNs();
+      release(m);
+      charge(start);
+    }
+  }
+  report(n, span, QUEUE);
+}
+
+static void benchList(int n, int span, int rounds) {
+  Time now = 0;
+  int i;
+
+  listTimers = NULL;
+  for (i = 0; i < n; i++) {
+    entries[i].baseline = random32() % span + 1;
+    listByBaseline(&entries[i], &listTimers);
+  }
+
+  for (i = 0; i < rounds; i++) {
+    ListEntry *expired = NULL, *p;
+
+    now = listTimers->baseline;
+    while (listTimers && !TIME_BEFORE(now, listTimers->baseline)) {
+      p = listDequeue(&listTimers);
+      p->next = expired;
+      expired = p;
+    }
+
+    while ((p = expired)) {
+      long long start;
+      expired = p->next;
+      p->baseline = TIME_ADD(now, random32() % span + 1);
+      start = clockNs();
+      listByBaseline(p, &listTimers);
+      TIMERSET(listTimers->baseline);
+      charge(start);
+    }
+  }
+  report(n, span, "list");
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : SAMPLES;
+  long long start;
+  int i, j;
+
+  for (i = 0; i < NMSGS; i++)
+    messages[i].heapIndex = -1;
+
+  start = clockNs();
+  for (i = 0; i < 1000; i++)
+    clockNs();
+  overhead = (clockNs() - start) / 1000;
+
+  printf("timers   span  queue   mean ns   p99 ns\n");
+  for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+    if (sizes[i] > NMSGS) {
+      printf("%6d  skipped, NMSGS is %d\n", sizes[i], NMSGS);
+      continue;
+    }
+    for (j = 0; j < sizeof spans / sizeof spans[0]; j++) {
+      seed = 0x2545F491;
+      benchKernel(sizes[i], spans[j], rounds);
+      seed = 0x2545F491;
+      benchList(sizes[i], spans[j], rounds);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Host stand-in for the STM32F4 device and peripheral library headers,
+ * used when TinyTimber is built with __TINYTIMBER_POSIX. It declares the
+ * part of the library that the drivers (sciTinyTimber.c, canTinyTimber.c,
+ * sioTinyTimber.c) use; peripherals.c emulates it on top of the POSIX
+ * kernel backend:
+ *
+ *   USART1   stdin/stdout, receive interrupt on input
+ *   CAN1/2   loopback: frames sent on either port are received on CAN1
+ *   GPIOB    user button on pin 7, toggled by SIGUSR2 (press, release, ...)
+ *   DAC      the audio sink: changes logged to $TT_DAC_LOG and the whole
+ *            stream captured to $TT_AUDIO_CAPTURE, if set
+ *
+ * Build and run the whole application on Linux with:
+ *
+ *   cc -no-pie -D__TINYTIMBER_POSIX -Ihost -I. -o music-player \
+ *      host/peripherals.c TinyTimber.c application.c buttonHandler.c \
+ *      canHandler.c canTinyTimber.c ledHandler.c melody.c musicPlayer.c \
+ *      sciTinyTimber.c sioTinyTimber.c toneGenerator.c audioEngine.c -lrt
+ *   TT_DAC_LOG=dac.log ./music-player
+ *
+ * or with make -C host, which also builds the simulator and the tools into
+ * host/build and runs the tests with make -C host check.
+ *
+ * Adding -D__TINYTIMBER_SIM -rdynamic -ldl builds the discrete-event
+ * simulator instead: time is simulated, so it runs as fast as the host
+ * allows and the same every time, and the input and the method costs come
+ * from the script named by $TT_SIM_SCRIPT (see peripherals.c).
+ *
+ * -Ihost must come first, so that these headers shadow device/ and driver/.
+ * Methods take pointers as int arguments (SCI_WRITE, CAN_SEND, ...), so on a
+ * 64-bit host all data must lie below 2 GB: build with -m32 where available,
+ * otherwise -no-pie, which keeps globals and the thread stacks there.
+ */
+
+#ifndef HOST_STM32F4XX_H
+#define HOST_STM32F4XX_H
+
+#include <stdint.h>
+
+typedef enum { RESET = 0, SET = !RESET } FlagStatus, ITStatus;
+typedef enum { DISABLE = 0, ENABLE = !DISABLE } FunctionalState;
+
+// USART
+
+typedef struct {
+  int receive_interrupt;
+  int transmit_interrupt;
+} USART_TypeDef;
+
+extern USART_TypeDef host_usart1;
+#define USART1 (&host_usart1)
+
+#define USART_IT_RXNE ((uint16_t)0x0525)
+#define USART_IT_TXE ((uint16_t)0x0727)
+
+#define USART_FLAG_RXNE ((uint16_t)0x0020)
+#define USART_FLAG_TXE ((uint16_t)0x0080)
+
+void USART_ITConfig(USART_TypeDef *usart, uint16_t it, FunctionalState state);
+FlagStatus USART_GetFlagStatus(USART_TypeDef *usart, uint16_t flag);
+uint16_t USART_ReceiveData(USART_TypeDef *usart);
+void USART_SendData(USART_TypeDef *usart, uint16_t data);
+
+// CAN
+
+typedef struct {
+  int receive_interrupt;
+} CAN_TypeDef;
+
+extern CAN_TypeDef host_can1, host_can2;
+#define CAN1 (&host_can1)
+#define CAN2 (&host_can2)
+
+typedef struct {
+  uint16_t CAN_Prescaler;
+  uint8_t CAN_Mode;
+  uint8_t CAN_SJW;
+  uint8_t CAN_BS1;
+  uint8_t CAN_BS2;
+  FunctionalState CAN_TTCM;
+  FunctionalState CAN_ABOM;
+  FunctionalState CAN_AWUM;
+  FunctionalState CAN_NART;
+  FunctionalState CAN_RFLM;
+  FunctionalState CAN_TXFP;
+} CAN_InitTypeDef;
+
+typedef struct {
+  uint32_t StdId;
+  uint32_t ExtId;
+  uint8_t IDE;
+  uint8_t RTR;
+  uint8_t DLC;
+  uint8_t Data[8];
+} CanTxMsg;
+
+typedef struct {
+  uint32_t StdId;
+  uint32_t ExtId;
+  uint8_t IDE;
+  uint8_t RTR;
+  uint8_t DLC;
+  uint8_t Data[8];
+  uint8_t FMI;
+} CanRxMsg;
+
+#define CAN_InitStatus_Failed ((uint8_t)0x00)
+#define CAN_InitStatus_Success ((uint8_t)0x01)
+
+#define CAN_Mode_Normal ((uint8_t)0x00)
+#define CAN_SJW_1tq ((uint8_t)0x00)
+#define CAN_BS1_3tq ((uint8_t)0x02)
+#define CAN_BS2_4tq ((uint8_t)0x03)
+
+#define CAN_Id_Standard ((uint32_t)0x00000000)
+#define CAN_RTR_Data ((uint32_t)0x00000000)
+
+#define CAN_TxStatus_Failed ((uint8_t)0x00)
+#define CAN_TxStatus_Ok ((uint8_t)0x01)
+#define CAN_TxStatus_Pending ((uint8_t)0x02)
+#define CAN_TxStatus_NoMailBox ((uint8_t)0x04)
+
+#define CAN_FIFO0 ((uint8_t)0x00)
+#define CAN_IT_FMP0 ((uint32_t)0x00000002)
+#define CAN_FLAG_FMP0 ((uint32_t)0x12000003)
+
+void CAN_StructInit(CAN_InitTypeDef *init);
+uint8_t CAN_Init(CAN_TypeDef *can, CAN_InitTypeDef *init);
+void CAN_ITConfig(CAN_TypeDef *can, uint32_t it, FunctionalState state);
+FlagStatus CAN_GetFlagStatus(CAN_TypeDef *can, uint32_t flag);
+void CAN_Receive(CAN_TypeDef *can, uint8_t fifo, CanRxMsg *msg);
+uint8_t CAN_Transmit(CAN_TypeDef *can, CanTxMsg *msg);
+uint8_t CAN_TransmitStatus(CAN_TypeDef *can, uint8_t mailbox);
+
+// The CAN node ID is set at run time by $TT_NODE_ID (see canHandler.h).
+extern int host_node_id;
+#define NODE_ID host_node_id
+
+// GPIO
+
+typedef struct {
+  uint16_t input;
+  uint16_t output;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef host_gpiob;
+#define GPIOB (&host_gpiob)
+
+#define GPIO_Pin_0 ((uint16_t)0x0001)
+#define GPIO_Pin_1 ((uint16_t)0x0002)
+#define GPIO_Pin_7 ((uint16_t)0x0080)
+
+typedef enum { Bit_RESET = 0, Bit_SET } BitAction;
+
+uint8_t GPIO_ReadInputDataBit(GPIO_TypeDef *gpio, uint16_t pin);
+void GPIO_WriteBit(GPIO_TypeDef *gpio, uint16_t pin, BitAction value);
+void GPIO_ToggleBits(GPIO_TypeDef *gpio, uint16_t pin);
+
+// EXTI
+
+typedef enum { EXTI_Mode_Interrupt = 0x00, EXTI_Mode_Event = 0x04 } EXTIMode_TypeDef;
+
+typedef enum {
+  EXTI_Trigger_Rising = 0x08,
+  EXTI_Trigger_Falling = 0x0C,
+  EXTI_Trigger_Rising_Falling = 0x10
+} EXTITrigger_TypeDef;
+
+typedef struct {
+  uint32_t EXTI_Line;
+  EXTIMode_TypeDef EXTI_Mode;
+  EXTITrigger_TypeDef EXTI_Trigger;
+  FunctionalState EXTI_LineCmd;
+} EXTI_InitTypeDef;
+
+#define EXTI_Line7 ((uint32_t)0x00080)
+
+void EXTI_StructInit(EXTI_InitTypeDef *init);
+void EXTI_Init(EXTI_InitTypeDef *init);
+ITStatus EXTI_GetITStatus(uint32_t line);
+void EXTI_ClearITPendingBit(uint32_t line);
+
+// SIMD: portable versions of the core_cm4_simd.h intrinsics
+
+static inline int16_t host_saturate16(int32_t x) {
+  return x > 32767 ? 32767 : x < -32768 ? -32768 : x;
+}
+
+// Saturating add of the two signed halfwords.
+static inline uint32_t __QADD16(uint32_t op1, uint32_t op2) {
+  int32_t lo = (int16_t)op1 + (int16_t)op2;
+  int32_t hi = (int16_t)(op1 >> 16) + (int16_t)(op2 >> 16);
+
+  return (uint16_t)host_saturate16(lo) |
+         (uint32_t)(uint16_t)host_saturate16(hi) << 16;
+}
+
+// Dual signed 16 x 16 multiply, both products added to op3.
+static inline uint32_t __SMLAD(uint32_t op1, uint32_t op2, uint32_t op3) {
+  return op3 + (uint32_t)((int16_t)op1 * (int16_t)op2) +
+         (uint32_t)((int16_t)(op1 >> 16) * (int16_t)(op2 >> 16));
+}
+
+#endif
@@ -0,0 +1,2 @@
+// Host stand-in, see stm32f4xx.h in this directory.
+#include "stm32f4xx.h"
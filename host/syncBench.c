@@ -0,0 +1,133 @@
+/*
+ * Latency of SYNC on the POSIX build of the kernel: with the receiver free,
+ * and with it locked by a message of lower priority. In the contended case
+ * the caller lends its priority to the owner until it unlocks, so the time
+ * covers the switch to the owner, the rest of the owner's method and the
+ * switch back. Mean and 99th percentile are in ns.
+ *
+ * A free receiver is locked by the fast path (__USE_FAST_SYNC), and also
+ * through the critical section, as SYNC from a handler always is. There
+ * sigprocmask() stands in for BASEPRI, five calls against the one with
+ * which the fast path reads the mask, so the host overstates what the fast
+ * path saves on the board. A contended SYNC always ends up in the critical
+ * section.
+ *
+ *   cc -O2 -no-pie -D__TINYTIMBER_POSIX -Ihost -I. -o syncBench \
+ *      host/syncBench.c TinyTimber.c -lrt
+ *   ./syncBench [rounds]
+ *
+ * or make -C host bench.
+ */
+
+#include "TinyTimber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLES 100000
+#define BUCKETS 100000 // of the histogram, 1 ns each
+
+typedef struct {
+  long long total;
+  int count;
+  int histogram[BUCKETS];
+} Cost;
+
+typedef struct {
+  Object super;
+  int rounds;
+  int done;
+} Bench;
+
+extern int posixHandler; // set, SYNC takes the critical section
+
+static Cost fast, locked, contended;
+static Object target = initObject();
+static Bench low = {initObject(), SAMPLES, 0};
+static Object high = initObject();
+
+static long long clockNs(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void charge(Cost *c, long long start) {
+  long long ns = clockNs() - start;
+  c->total += ns;
+  c->count++;
+  c->histogram[ns < BUCKETS ? ns : BUCKETS - 1]++;
+}
+
+static int percentile99(Cost *c) {
+  int i, seen = 0;
+  for (i = 0; i < BUCKETS - 1; i++)
+    if ((seen += c->histogram[i]) >= c->count * 0.99)
+      break;
+  return i;
+}
+
+static void report(const char *label, Cost *c, Cost *d) {
+  printf("%-12s %8.1f %8d", label, (double)c->total / c->count,
+         percentile99(c));
+  if (d)
+    printf("  %8.1f %8d", (double)d->total / d->count, percentile99(d));
+  printf("\n");
+}
+
+static int nothing(Object *self, int arg) { return arg; }
+
+// high: SYNC with target, which the low message holds
+static int contend(Object *self, int unused) {
+  long long start = clockNs();
+  SYNC(&target, nothing, 0);
+  charge(&contended, start);
+  return 0;
+}
+
+// target, locked by low: preempted at once by contend, of a nearer deadline
+static int hold(Object *self, int unused) {
+  BEFORE(USEC(10), &high, contend, 0);
+  return 0;
+}
+
+static int owner(Bench *self, int unused) {
+  SYNC(&target, hold, 0);
+  if (++self->done < self->rounds) {
+    SEND(0, MSEC(100), self, owner, 0);
+    return 0;
+  }
+
+  printf("                 fast path            locked\n");
+  printf("sync         mean ns   p99 ns   mean ns   p99 ns\n");
+  report("uncontended", &fast, &locked);
+  report("contended", &contended, NULL);
+  exit(0);
+}
+
+static int start(Bench *self, int unused) {
+  int i;
+
+  for (i = 0; i < self->rounds; i++) {
+    long long start = clockNs();
+    SYNC(&target, nothing, 0);
+    charge(&fast, start);
+  }
+  for (i = 0; i < self->rounds; i++) {
+    long long start = clockNs();
+    posixHandler = 1;
+    SYNC(&target, nothing, 0);
+    posixHandler = 0;
+    charge(&locked, start);
+  }
+  SEND(0, MSEC(100), self, owner, 0);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1)
+    low.rounds = atoi(argv[1]);
+  return tinytimber((Object *)&low, (Method)start, 0);
+}
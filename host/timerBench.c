@@ -0,0 +1,175 @@
+/*
+ * Cost of the kernel's timer queue with n timers pending, against the
+ * sorted list it replaced (listQueue.h). A timer is inserted at a random
+ * baseline up to SPAN ticks ahead, and expiring is what the timer interrupt
+ * does: the earliest timers are moved to the ready queue, which is then
+ * emptied again. The queue is held at n timers by inserting one for each
+ * that expires. Times are per timer, in ns, with the cost of reading the
+ * clock taken off.
+ *
+ * The kernel is compiled into this file as the simulator build, whose
+ * clock is a variable, and NMSGS must be at least the largest n:
+ *
+ *   cc -O2 -no-pie -D__TINYTIMBER_SIM -DNMSGS=1024 -Ihost -I. \
+ *      -o timerBench host/timerBench.c -lrt
+ *   ./timerBench [rounds]
+ *
+ * or make -C host bench.
+ */
+
+#include "TinyTimber.c"
+#include "listQueue.h"
+
+#include <stdio.h>
+
+#define SPAN 65536 // ticks ahead that a timer may be inserted
+#define SAMPLES 100000
+
+static const int sizes[] = {30, 256, 1024};
+
+static uint32_t seed;
+static ListEntry entries[NMSGS];
+static ListEntry *listTimers, *listReady;
+
+// The simulator build takes its input from peripherals.c, not needed here.
+int sim_next_input(Time *at) { return 0; }
+void sim_input(void) {}
+
+static uint32_t random32(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static long long clockNs(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+typedef struct {
+  long long total;
+  int count;
+} Cost;
+
+static long long overhead; // of a clockNs() pair
+
+static void charge(Cost *c, long long start, int n) {
+  c->total += clockNs() - start - overhead;
+  c->count += n;
+}
+
+static void report(int n, const char *queue, Cost *insert, Cost *expire) {
+  printf("%6d  %-6s %10.1f %10.1f\n", n, queue,
+         (double)insert->total / insert->count,
+         (double)expire->total / expire->count);
+}
+
+static void kernelInsert(Message m, Time baseline) {
+  m->baseline = baseline;
+  m->deadline = TIME_ADD(baseline, SPAN);
+  enqueueByBaseline(m, &timerQ);
+}
+
+static void benchKernel(int n, int rounds) {
+  Cost insertCost = {0}, expireCost = {0};
+  int i;
+
+  timerQ.size = 0;
+  simNow = 0;
+  for (i = 0; i < n; i++) {
+    messages[i].infinite = 0;
+    kernelInsert(&messages[i], random32() % SPAN + 1);
+  }
+
+  for (i = 0; i < rounds; i++) {
+    Message expired[NMSGS];
+    long long start;
+    int k = 0;
+
+    simNow = HEAP_TOP(&timerQ)->baseline;
+    start = clockNs();
+    expire((Time)simNow);
+    while (readyTop(&msgQ))
+      expired[k++] = dequeueReady(&msgQ);
+    charge(&expireCost, start, k);
+
+    while (k--) {
+      Time baseline = TIME_ADD(simNow, random32() % SPAN + 1);
+      start = clockNs();
+      kernelInsert(expired[k], baseline);
+      charge(&insertCost, start, 1);
+    }
+  }
+  report(n, "heap", &insertCost, &expireCost);
+}
+
+static void benchList(int n, int rounds) {
+  Cost insertCost = {0}, expireCost = {0};
+  Time now = 0;
+  int i;
+
+  listTimers = listReady = NULL;
+  for (i = 0; i < n; i++) {
+    entries[i].baseline = random32() % SPAN + 1;
+    entries[i].deadline = TIME_ADD(entries[i].baseline, SPAN);
+    entries[i].infinite = 0;
+    listByBaseline(&entries[i], &listTimers);
+  }
+
+  for (i = 0; i < rounds; i++) {
+    ListEntry *expired = NULL, *p;
+    long long start;
+    int k = 0;
+
+    now = listTimers->baseline;
+    start = clockNs();
+    while (listTimers && !TIME_BEFORE(now, listTimers->baseline))
+      listByDeadline(listDequeue(&listTimers), &listReady);
+    while ((p = listDequeue(&listReady))) {
+      p->next = expired;
+      expired = p;
+      k++;
+    }
+    charge(&expireCost, start, k);
+
+    while ((p = expired)) {
+      Time baseline = TIME_ADD(now, random32() % SPAN + 1);
+      expired = p->next;
+      start = clockNs();
+      p->baseline = baseline;
+      p->deadline = TIME_ADD(baseline, SPAN);
+      listByBaseline(p, &listTimers);
+      charge(&insertCost, start, 1);
+    }
+  }
+  report(n, "list", &insertCost, &expireCost);
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : SAMPLES;
+  long long start;
+  int i;
+
+  for (i = 0; i < NMSGS; i++)
+    messages[i].heapIndex = -1;
+
+  start = clockNs();
+  for (i = 0; i < 1000; i++)
+    clockNs();
+  overhead = (clockNs() - start) / 1000;
+
+  printf("timers  queue   insert ns  expire ns\n");
+  for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+    if (sizes[i] > NMSGS) {
+      printf("%6d  skipped, NMSGS is %d\n", sizes[i], NMSGS);
+      continue;
+    }
+    seed = 0x2545F491;
+    benchKernel(sizes[i], rounds);
+    seed = 0x2545F491;
+    benchList(sizes[i], rounds);
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Host-side decoder for the TinyTimber kernel trace (__TRACE_BUFFER).
+ *
+ * Reads a raw capture of USART1 on stdin, picks out the trace frames (any
+ * console text in between is skipped) and writes the events as Chrome trace
+ * JSON on stdout, which chrome://tracing and ui.perfetto.dev can open.
+ * Methods are shown by name if the output of nm for the firmware image is
+ * given as an argument:
+ *
+ *   arm-none-eabi-nm Debug/RTS-Lab.elf > symbols.txt
+ *   cc -o traceDecoder host/traceDecoder.c
+ *   ./traceDecoder symbols.txt < capture.bin > trace.json
+ *
+ * The frame format and event numbers must match TinyTimber.c.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_FRAME_START 0x1E
+#define TRACE_FRAME_SIZE 12
+
+#define TICK_USEC 10 // one TIM5 tick
+
+#define IRQ_TID 100 // Chrome "thread" used for interrupt handlers
+
+enum trace_event {
+  TRACE_DISPATCH = 1,
+  TRACE_RUN,
+  TRACE_DONE,
+  TRACE_ASYNC,
+  TRACE_BLOCK,
+  TRACE_ABORT,
+  TRACE_EXPIRE,
+  TRACE_IRQ_ENTER,
+  TRACE_IRQ_EXIT,
+  TRACE_LOST
+};
+
+// names of enum Vector in TinyTimber.h, indexed by IRQn
+static const char *vector_names[] = {
+    "WWDG", "PVD", "TAMP_STAMP", "RTC_WKUP", "FLASH", "RCC", "EXTI0", "EXTI1",
+    "EXTI2", "EXTI3", "EXTI4", "DMA1_Stream0", "DMA1_Stream1", "DMA1_Stream2",
+    "DMA1_Stream3", "DMA1_Stream4", "DMA1_Stream5", "DMA1_Stream6", "ADC",
+    "CAN1_TX", "CAN1_RX0", "CAN1_RX1", "CAN1_SCE", "EXTI9_5", "TIM1_BRK_TIM9",
+    "TIM1_UP_TIM10", "TIM1_TRG_COM_TIM11", "TIM1_CC", "TIM2", "TIM3", "TIM4",
+    "I2C1_EV", "I2C1_ER", "I2C2_EV", "I2C2_ER", "SPI1", "SPI2", "USART1",
+    "USART2", "USART3", "EXTI15_10", "RTC_Alarm", "OTG_FS_WKUP",
+    "TIM8_BRK_TIM12", "TIM8_UP_TIM13", "TIM8_TRG_COM_TIM14", "TIM8_CC",
+    "DMA1_Stream7", "FSMC", "SDIO", "TIM5", "SPI3", "UART4", "UART5",
+    "TIM6_DAC", "TIM7", "DMA2_Stream0", "DMA2_Stream1", "DMA2_Stream2",
+    "DMA2_Stream3", "DMA2_Stream4", "ETH", "ETH_WKUP", "CAN2_TX", "CAN2_RX0",
+    "CAN2_RX1", "CAN2_SCE", "OTG_FS", "DMA2_Stream5", "DMA2_Stream6",
+    "DMA2_Stream7", "USART6", "I2C3_EV", "I2C3_ER", "OTG_HS_EP1_OUT",
+    "OTG_HS_EP1_IN", "OTG_HS_WKUP", "OTG_HS", "DCMI", "CRYP", "HASH_RNG", "FPU"};
+
+typedef struct {
+  uint32_t id;
+  char name[64];
+} Symbol;
+
+static Symbol *symbols = NULL;
+static int symbol_count = 0;
+
+static void load_symbols(const char *path) {
+  FILE *file = fopen(path, "r");
+  char line[256];
+  int capacity = 0;
+
+  if (!file) {
+    perror(path);
+    exit(1);
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    unsigned long address;
+    char type;
+    char name[64];
+
+    if (sscanf(line, "%lx %c %63s", &address, &type, name) != 3)
+      continue;
+    if (type != 'T' && type != 't')
+      continue;
+
+    if (symbol_count == capacity) {
+      capacity = capacity ? 2 * capacity : 256;
+      symbols = realloc(symbols, capacity * sizeof(Symbol));
+    }
+
+    symbols[symbol_count].id = address & ~1ul; // without the Thumb bit
+    strcpy(symbols[symbol_count].name, name);
+    symbol_count++;
+  }
+
+  fclose(file);
+}
+
+static const char *method_name(uint32_t id) {
+  static char buffer[16];
+
+  for (int i = 0; i < symbol_count; i++)
+    if (symbols[i].id == (id & ~1u))
+      return symbols[i].name;
+
+  snprintf(buffer, sizeof(buffer), "0x%08x", id);
+
+  return buffer;
+}
+
+static const char *vector_name(uint32_t id) {
+  static char buffer[16];
+
+  if (id < sizeof(vector_names) / sizeof(vector_names[0]))
+    return vector_names[id];
+
+  snprintf(buffer, sizeof(buffer), "IRQ %u", id);
+
+  return buffer;
+}
+
+static int first_event = 1;
+
+static void emit(const char *phase, const char *name, int tid,
+                 unsigned long long usec) {
+  printf("%s\n{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%llu",
+         first_event ? "" : ",", phase, name, tid, usec);
+  if (phase[0] == 'i')
+    printf(",\"s\":\"t\"");
+  printf("}");
+
+  first_event = 0;
+}
+
+static void decode(const uint8_t *record, unsigned long long usec) {
+  uint8_t event = record[4];
+  int tid = record[5];
+  uint32_t id = record[6] | (record[7] << 8) | (record[8] << 16) |
+                ((uint32_t)record[9] << 24);
+  char name[96];
+
+  switch (event) {
+  case TRACE_DISPATCH:
+    snprintf(name, sizeof(name), "dispatch to thread %u", id);
+    emit("i", name, tid, usec);
+    break;
+  case TRACE_RUN:
+    emit("B", method_name(id), tid, usec);
+    break;
+  case TRACE_DONE:
+    emit("E", method_name(id), tid, usec);
+    break;
+  case TRACE_ASYNC:
+    snprintf(name, sizeof(name), "send %s", method_name(id));
+    emit("i", name, tid, usec);
+    break;
+  case TRACE_BLOCK:
+    snprintf(name, sizeof(name), "blocked by thread %u", id);
+    emit("i", name, tid, usec);
+    break;
+  case TRACE_ABORT:
+    snprintf(name, sizeof(name), "abort %s", method_name(id));
+    emit("i", name, tid, usec);
+    break;
+  case TRACE_EXPIRE:
+    snprintf(name, sizeof(name), "release %s", method_name(id));
+    emit("i", name, IRQ_TID, usec);
+    break;
+  case TRACE_IRQ_ENTER:
+    emit("B", vector_name(id), IRQ_TID, usec);
+    break;
+  case TRACE_IRQ_EXIT:
+    emit("E", vector_name(id), IRQ_TID, usec);
+    break;
+  case TRACE_LOST:
+    snprintf(name, sizeof(name), "%u records lost", id);
+    emit("i", name, tid, usec);
+    break;
+  default:
+    fprintf(stderr, "unknown trace event %d\n", event);
+  }
+}
+
+int main(int argc, char **argv) {
+  uint8_t frame[TRACE_FRAME_SIZE];
+  int length = 0;
+  int c;
+  uint32_t last_time = 0;
+  unsigned long long epoch = 0;
+  int frames = 0, bad = 0;
+
+  if (argc > 1)
+    load_symbols(argv[1]);
+
+  printf("{\"traceEvents\":[");
+
+  while ((c = getchar()) != EOF) {
+    if (length == 0 && c != TRACE_FRAME_START)
+      continue; // console output between frames
+
+    frame[length++] = c;
+    if (length < TRACE_FRAME_SIZE)
+      continue;
+
+    uint8_t check = 0;
+    for (int i = 1; i < TRACE_FRAME_SIZE - 1; i++)
+      check ^= frame[i];
+
+    if (check != frame[TRACE_FRAME_SIZE - 1]) {
+      // Not a frame after all: rescan from the byte after the start.
+      bad++;
+      for (length = 1; length < TRACE_FRAME_SIZE; length++)
+        if (frame[length] == TRACE_FRAME_START)
+          break;
+      memmove(frame, frame + length, TRACE_FRAME_SIZE - length);
+      length = TRACE_FRAME_SIZE - length;
+      continue;
+    }
+
+    uint32_t time = frame[1] | (frame[2] << 8) | (frame[3] << 16) |
+                    ((uint32_t)frame[4] << 24);
+
+    if (frames && time < last_time && last_time - time > 0x80000000u)
+      epoch += 1ULL << 32; // TIM5 wrapped around
+    last_time = time;
+
+    decode(frame + 1, (epoch + time) * TICK_USEC);
+    frames++;
+    length = 0;
+  }
+
+  printf("\n]}\n");
+
+  fprintf(stderr, "%d trace records, %d bad frames skipped\n", frames, bad);
+
+  return 0;
+}
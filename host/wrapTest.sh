@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Checks that the kernel keeps time across the wraps of its clock. The
+# simulator (see stm32f4xx.h) plays the melody once from time 0, and then
+# again from a second before each of several wraps of the 32-bit tick
+# count: 2^31, where the signed difference of two times changes sign,
+# 2^32, where the count itself wraps, and the ones after them. Every run
+# must write the same console output and the same DAC changes, at the same
+# times from its start, as the run from 0.
+#
+#   ./wrapTest.sh [music-player-sim]
+#
+
+sim=${1:-./build/music-player-sim}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+play() { # start in us
+  cat >"$dir/play.sim" <<EOF
+start $1
+cost * 5
+cost player_tick 50
+1000 key e
+2000 key 60t
+3000 key v
+8000000 key ph
+8001000 end
+EOF
+  TT_SIM_SCRIPT="$dir/play.sim" TT_DAC_LOG="$dir/dac.log" "$sim" \
+    >"$dir/out" 2>/dev/null || return 1
+  awk -v start="$1" '{ print $1 - start, $2 }' "$dir/dac.log"
+}
+
+play 0 >"$dir/dac0" || { echo "wrapTest: $sim failed"; exit 1; }
+mv "$dir/out" "$dir/out0"
+if [ ! -s "$dir/dac0" ]; then
+  echo "wrapTest: no audio from $sim"
+  exit 1
+fi
+
+failed=0
+for wrap in 1 2 3 4 5; do
+  start=$(((wrap << 31) * 10 - 1000000)) # 10 us ticks
+  if ! play $start >"$dir/dac" || ! cmp -s "$dir/dac0" "$dir/dac" ||
+    ! cmp -s "$dir/out0" "$dir/out"; then
+    echo "wrapTest: wrong across wrap $wrap of 2^31 ticks (start $start us)"
+    failed=1
+  fi
+done
+
+[ $failed = 0 ] && echo "wrapTest: passed"
+exit $failed
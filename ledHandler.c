@@ -28,34 +28,46 @@ void set_led_blink_period(LedHandler *self, int period) {
   //     SEND(MSEC(self->blink_period), USEC(50), self, led_tick, 0);
 }
 
+static void stop_led_blink(LedHandler *self) {
+  if (self->led_tick_call) {
+    CANCEL(self->led_tick_call);
+
+    self->led_tick_call = NULL;
+  }
+}
+
+// Restart the periodic led_tick, in phase with the current baseline.
+static void restart_led_blink(LedHandler *self) {
+  stop_led_blink(self);
+
+  self->led_tick_call =
+      PERIODIC(MSEC(self->current_blink_period),
+               MSEC(self->current_blink_period), USEC(100), self, led_tick, 0);
+}
+
 void set_next_tone(LedHandler *self, int unused) {
   if (self->current_blink_period == self->blink_period)
     return;
 
   self->current_blink_period = self->blink_period;
 
-  if (self->led_tick_call)
-    ABORT(self->led_tick_call);
+  restart_led_blink(self);
+}
 
-  self->led_tick_call =
-      SEND(MSEC(self->current_blink_period), USEC(100), self, led_tick, 0);
+void start_led_blink(LedHandler *self, int unused) {
+  toggle_led(self, 0);
+
+  restart_led_blink(self);
 }
 
 void led_tick(LedHandler *self, int unused) {
-  self->led_tick_call = NULL;
-
   if (self->state == LED_DISABLED) {
     SIO_WRITE(&sio, 1);
 
-    return;
-  }
+    stop_led_blink(self);
 
-  if (self->state == LED_ON) {
-    set_led(self, LED_OFF);
-  } else {
-    set_led(self, LED_ON);
+    return;
   }
 
-  self->led_tick_call =
-      SEND(MSEC(self->current_blink_period), USEC(100), self, led_tick, 0);
+  toggle_led(self, 0);
 }
\ No newline at end of file
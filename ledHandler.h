@@ -33,6 +33,7 @@ void set_next_tone(LedHandler *self, int unused);
 
 void toggle_led(LedHandler *self, int unused);
 
+void start_led_blink(LedHandler *self, int unused);
 void led_tick(LedHandler *self, int unused);
 
 #endif
\ No newline at end of file
@@ -1,7 +1,5 @@
 #include "melody.h"
 
-volatile unsigned char *DAC_ADDRESS = ((volatile unsigned char *)0x4000741C);
-
 const int MELODY_FREQUENCY_INDICES[32] = {0, 2, 4, 0, 0, 2,  4, 0, 4,  5, 7,
                                           4, 5, 7, 7, 9, 7,  5, 4, 0,  7, 9,
                                           7, 5, 4, 0, 0, -5, 0, 0, -5, 0};
@@ -25,8 +25,6 @@
 #define BEAT_B (BEAT_A / 2.)
 #define BEAT_C (BEAT_A * 2.)
 
-extern volatile unsigned char *DAC_ADDRESS;
-
 extern const int MELODY_FREQUENCY_INDICES[32];
 extern const int
     FREQUENCY_PERIODS[MAX_FREQUENCY_INDICE - MIN_FREQUENCY_INDICE + 1];
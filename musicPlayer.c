@@ -13,7 +13,7 @@ bool start_music(MusicPlayer *self) {
 
   SYNC(&led_handler, set_led_blink_period, self->tempo);
   SYNC(&led_handler, set_led, LED_ON);
-  SYNC(&led_handler, led_tick, 0);
+  SYNC(&led_handler, start_led_blink, 0);
 
   ASYNC(self, player_tick, 0);
 
@@ -27,8 +27,6 @@ bool stop_music(MusicPlayer *self) {
   self->is_playing = false;
   self->tone_index = 0;
 
-  *DAC_ADDRESS = 0;
-
   SYNC(&tone_generator, stop_tone, 0);
   SYNC(&led_handler, set_led, LED_DISABLED);
 
@@ -47,6 +45,14 @@ bool toggle_music_mute(MusicPlayer *self) {
   return muted;
 }
 
+bool toggle_music_bass(MusicPlayer *self) {
+  return SYNC(&tone_generator, toggle_bass, 0);
+}
+
+bool change_waveform(MusicPlayer *self, int waveform) {
+  return SYNC(&tone_generator, set_waveform, waveform);
+}
+
 bool change_tempo(MusicPlayer *self, int bpm) {
   if (bpm < MIN_TEMPO || bpm > MAX_TEMPO)
     return false;
@@ -110,7 +116,7 @@ void player_tick(MusicPlayer *self, int unused) {
 #endif
 
     SYNC(&led_handler, set_next_tone, 0);
-    ASYNC(&tone_generator, tone_tick, 0);
+    SYNC(&tone_generator, start_tone, 0);
 
     // Go to next tone after the current beat.
     self->tone_index = (self->tone_index + 1) % 32;
@@ -26,6 +26,8 @@ bool stop_music(MusicPlayer *self);
 void player_tick(MusicPlayer *self, int);
 
 bool toggle_music_mute(MusicPlayer *self);
+bool toggle_music_bass(MusicPlayer *self);
+bool change_waveform(MusicPlayer *self, int waveform);
 
 int change_music_volume(MusicPlayer *self, int increment);
 bool change_tempo(MusicPlayer *self, int bpm);
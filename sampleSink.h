@@ -0,0 +1,32 @@
+#ifndef SAMPLE_SINK_H
+#define SAMPLE_SINK_H
+
+#include <stdint.h>
+
+#define SINK_MIDSCALE 2048 // 12-bit samples, silence at mid-scale
+#define SINK_MAX 4095
+
+//
+// Where the audio engine's samples go. The engine owns a circular buffer of
+// 12-bit samples in two halves. start() begins playing it at AUDIO_RATE,
+// played() reports which halves (bit 0 the first, bit 1 the second) have
+// been played since the last call and are free to refill, and filled() is
+// told of every half once it has been refilled.
+//
+typedef struct {
+  void (*start)(uint16_t *buf, int n);
+  int (*played)(void);
+  void (*filled)(const uint16_t *half, int n);
+} SampleSink;
+
+// DAC channel 2, fed by DMA on the board (dacSink.c). The host build has a
+// sink that records the stream instead (host/peripherals.c).
+#ifdef __TINYTIMBER_POSIX
+extern const SampleSink host_sink;
+#define AUDIO_SINK (&host_sink)
+#else
+extern const SampleSink dac_sink;
+#define AUDIO_SINK (&dac_sink)
+#endif
+
+#endif
@@ -6,8 +6,6 @@ void sci_init(Serial *self, int unused) {
 
 	USART_ITConfig( USART1, USART_IT_RXNE, ENABLE);
 	USART_ITConfig( USART1, USART_IT_TXE, DISABLE);
-	NVIC_SetPriority( USART1_IRQn, __IRQ_PRIORITY);
-	NVIC_EnableIRQ( USART1_IRQn);
   
 }
 
@@ -45,8 +43,10 @@ int sci_interrupt(Serial *self, int unused) {
 		c = USART_ReceiveData( self->port);
 		
         if (self->obj) {
-			ASYNC(self->obj, self->meth, c);
-			doIRQSchedule = 1;
+			if (TRY_ASYNC(self->obj, self->meth, c))
+				doIRQSchedule = 1;
+			else
+				self->dropped++;
 		}
     } 
     
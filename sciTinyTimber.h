@@ -14,11 +14,12 @@ typedef struct {
     int head;
     int tail;
     int count;
+    int dropped;    // received characters lost to an empty message pool
     char buf[SCI_BUFSIZE];
 } Serial;
 
 #define initSerial(port, obj, meth) \
-    { initObject(), port, (Object*)obj, (Method)meth, 0, 0, 0 }
+    { initObject(), port, (Object*)obj, (Method)meth, 0, 0, 0, 0 }
 
 #define SCI_PORT0   (USART_TypeDef *)(USART1)
 #define	SCI_IRQ0	IRQ_USART1
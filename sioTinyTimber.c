@@ -4,9 +4,6 @@
 void sio_init(SysIO *self, int unused) {
 
     GPIO_WriteBit(GPIOB, GPIO_Pin_0, (BitAction) 0); // Green LED On
-
-	NVIC_SetPriority( EXTI9_5_IRQn, __IRQ_PRIORITY);
-	NVIC_EnableIRQ( EXTI9_5_IRQn );
 }
 
 int sio_read(SysIO *self, int unused) {
@@ -267,7 +267,7 @@ static void __sys_init() {
     //
     // FPU enabled by dbgARM monitor, in function SystemInit() called by ResetHandler 
 	//	SCB->CPACR = 0xF00000; // Enable FPU
-	FPU->FPCCR = 0x80000000; // No lazy stacking
+	FPU->FPCCR = 0xC0000000; // Automatic and lazy FP state preservation
 }
 
 static void __timer_init() {
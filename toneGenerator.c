@@ -1,7 +1,75 @@
 #include "toneGenerator.h"
 #include "melody.h"
 
-void stop_tone(ToneGenerator *self) { self->is_not_in_gap = false; }
+#if AUDIO_RATE != 20000
+#error "PHASE_INCREMENTS are computed for a 20 kHz sample rate"
+#endif
+
+#if ENV_RELEASE_MS > GAP_SILENCE
+#error "a note must have faded out before the next one starts"
+#endif
+
+// The phase increment of each note of FREQUENCY_PERIODS, round(440 Hz *
+// 2^(indice / 12) * 2^32 / AUDIO_RATE).
+static const uint32_t
+    PHASE_INCREMENTS[MAX_FREQUENCY_INDICE - MIN_FREQUENCY_INDICE + 1] = {
+        53030316,  56183662,  59524517,  63064029,  66814011,
+        70786979,  74996192,  79455697,  84180379,  89186005,
+        94489281,  100107906, 106060631, 112367325, 119049034,
+        126128057, 133628022, 141573958, 149992383, 158911395,
+        168360758, 178372009, 188978561, 200215811, 212121263};
+
+static int phase_increment(int frequency) {
+  return PHASE_INCREMENTS[frequency - MIN_FREQUENCY_INDICE];
+}
+
+// MAX_VOLUME is the full scale of the DAC.
+static void update_level(ToneGenerator *self) {
+  int volume = self->is_muted ? 0 : self->volume;
+
+  SYNC(&audio, audio_set_gain, volume * 32767 / MAX_VOLUME);
+}
+
+static void release(int *note) {
+  if (*note) {
+    SYNC(&audio, audio_note_off, *note);
+
+    *note = 0;
+  }
+}
+
+static void silence(ToneGenerator *self) {
+  release(&self->melody_note);
+  release(&self->bass_note);
+}
+
+static void sound(ToneGenerator *self) {
+  int increment = phase_increment(self->frequency);
+
+  silence(self);
+
+  self->melody_note = SYNC(&audio, audio_note_on, increment);
+  if (self->has_bass)
+    self->bass_note = SYNC(&audio, audio_note_on, increment >> 2);
+}
+
+/**
+ * Starts the tone at the current frequency. The audio engine renders the
+ * wave into the DAC buffer by itself, so a held tone costs no messages at
+ * all.
+ *
+ * @param self A pointer to the ToneGenerator.
+ */
+void start_tone(ToneGenerator *self, int unused) {
+  update_level(self);
+  sound(self);
+}
+
+void stop_tone(ToneGenerator *self) {
+  self->is_not_in_gap = false;
+
+  silence(self);
+}
 
 /**
  * Toggles the mute state of the application.
@@ -11,12 +79,26 @@ void stop_tone(ToneGenerator *self) { self->is_not_in_gap = false; }
 bool toggle_mute(ToneGenerator *self) {
   self->is_muted = !self->is_muted;
 
-  if (self->is_muted)
-    *DAC_ADDRESS = 0;
+  update_level(self);
 
   return self->is_muted;
 }
 
+/**
+ * Toggles the bass voice, which doubles the melody two octaves down. It
+ * takes effect from the next note.
+ *
+ * @param self A pointer to the ToneGenerator.
+ */
+bool toggle_bass(ToneGenerator *self) {
+  self->has_bass = !self->has_bass;
+
+  if (!self->has_bass)
+    release(&self->bass_note);
+
+  return self->has_bass;
+}
+
 /**
  * Changes the volume of the application.
  *
@@ -29,52 +111,43 @@ int change_volume(ToneGenerator *self, int increment) {
     self->is_muted = false;
 
   if (self->volume + increment > MAX_VOLUME ||
-      self->volume + increment < MIN_VOLUME)
+      self->volume + increment < MIN_VOLUME) {
+    update_level(self);
     return false;
+  }
 
   self->volume += increment;
 
+  update_level(self);
+
   return self->volume;
 }
 
 bool set_frequency(ToneGenerator *self, int frequency) {
   self->frequency = frequency;
 
+  if (self->melody_note)
+    sound(self);
+
   return true;
 }
 
-bool toggle_is_playing(ToneGenerator *self) {
-  self->is_not_in_gap = !self->is_not_in_gap;
-
-  return self->is_not_in_gap;
-}
+bool set_waveform(ToneGenerator *self, int waveform) {
+  if (waveform < 0 || waveform >= N_WAVES)
+    return false;
 
-/**
- * Updates the tone output based on the given frequency period.
- * If the tone is not muted, it toggles the wave flip and sets the DAC address
- * accordingly. If the tone is muted, it sets the DAC address to 0. If the
- * deadline control is enabled, it schedules the next tone_tick event using
- * SEND. If the deadline control is disabled, it schedules the next tone_tick
- * event using AFTER.
- *
- * @param self The pointer to the App structure.
- * @param frequency_period The period of the frequency in microseconds.
- */
-void tone_tick(ToneGenerator *self) {
-  bool is_muted = self->is_muted;
+  self->waveform = waveform;
 
-  // Tone is muted, do not play. Go to next tick.
-  if (!is_muted) {
-    self->wave_flip ^= 1;
+  SYNC(&audio, audio_set_wave, waveform);
 
-    int volume = self->volume;
+  return true;
+}
 
-    *DAC_ADDRESS = self->wave_flip * volume;
-  } else
-    *DAC_ADDRESS = 0;
+bool toggle_is_playing(ToneGenerator *self) {
+  self->is_not_in_gap = !self->is_not_in_gap;
 
-  int frequency_period = get_period_from_frequency_indice(self->frequency);
+  if (!self->is_not_in_gap)
+    silence(self);
 
-  if (self->is_not_in_gap)
-    SEND(USEC(frequency_period), USEC(100), self, tone_tick, 0);
-}
\ No newline at end of file
+  return self->is_not_in_gap;
+}
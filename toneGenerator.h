@@ -2,35 +2,39 @@
 #define TONE_GENERATOR_H
 
 #include "TinyTimber.h"
+#include "audioEngine.h"
 #include <stdbool.h>
 
 #define initToneGenerator()                                                    \
-  { initObject(), false, false, 0, 0, 0, 10 }
+  { initObject(), false, false, false, 0, 10, WAVE_SQUARE, 0, 0 }
 
 typedef struct {
   Object super;
 
   bool is_not_in_gap;
   bool is_muted;
+  bool has_bass; // double the melody two octaves down
 
   int frequency;
-  int period;
-
-  int wave_flip;
 
   int volume;
+  int waveform;
+
+  int melody_note; // audio engine notes, 0 when silent
+  int bass_note;
 } ToneGenerator;
 
+void start_tone(ToneGenerator *self, int unused);
 void stop_tone(ToneGenerator *self);
 
-void tone_tick(ToneGenerator *self);
-
 bool toggle_mute(ToneGenerator *self);
+bool toggle_bass(ToneGenerator *self);
 bool toggle_is_playing(ToneGenerator *self);
 
 int change_volume(ToneGenerator *self, int increment);
 
 bool set_frequency(ToneGenerator *self, int frequency);
+bool set_waveform(ToneGenerator *self, int waveform);
 
 extern ToneGenerator tone_generator;
 